@@ -0,0 +1,202 @@
+﻿#pragma once
+
+// очередь каталогов для потоков обхода; вынесена из FileFinder.cpp,
+// чтобы микробенчмарки проверяли её отдельно от перечисления
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// порядок обхода
+enum class Traversal {
+    dfs,     // свои задачи с хвоста (LIFO): фронт не шире глубины дерева, соседние каталоги идут подряд
+    bfs,     // свои задачи с головы (FIFO), как было изначально
+    hybrid,  // в ширину, пока очередь короткая и потокам не хватает работы, дальше в глубину
+};
+
+inline const char* traversal_name(Traversal t) {
+    switch (t) {
+    case Traversal::bfs: return "bfs";
+    case Traversal::hybrid: return "hybrid";
+    default: return "dfs";
+    }
+}
+
+// планировщик директорий с перехватом работы (work stealing):
+// у каждого потока свой дек, свои задачи берутся в порядке policy,
+// чужие — с головы (самые старые, обычно это крупные поддеревья).
+// Задачи делятся на группы (устройства): у группы может быть предел потоков, одновременно
+// обходящих её каталоги, и поток, упёршийся в предел, берёт задачи других групп.
+// T — дешёво копируемый дескриптор каталога; в программе это const DirNode*
+template <class T>
+class BasicDirQueue {
+public:
+    // как была получена задача: для трассировки и статистики
+    struct PopInfo {
+        int victim = -1;     // поток, у которого задача перехвачена, -1 — своя
+        bool waited = false; // поток засыпал в ожидании работы
+    };
+
+    // budgets — предел потоков для каждой группы; пусто — одна группа без предела
+    BasicDirQueue(int num_workers, Traversal policy, std::vector<int> budgets = {})
+        : locals(num_workers), policy(policy), hybrid_threshold(static_cast<size_t>(num_workers) * 64),
+          budget(budgets.empty() ? std::vector<int>{ INT_MAX } : std::move(budgets)),
+          active(new std::atomic<int>[budget.size()]), limited(budget.size() > 1 || budget[0] < num_workers) {
+        for (size_t g = 0; g < budget.size(); ++g)
+            active[g].store(0, std::memory_order_relaxed);
+        for (Local& l : locals)
+            l.dq.resize(budget.size());
+    }
+
+    // добавление директории в дек потока id, в группу каталога, который он сейчас обходит
+    void push(int id, T p) { push(id, p, locals[id].group); }
+
+    void push(int id, T p, unsigned group) {
+        {
+            std::lock_guard<std::mutex> lk(locals[id].mtx);
+            locals[id].dq[group].push_back(p);
+        }
+        queued.fetch_add(1, std::memory_order_relaxed);
+        if (sleeping.load() > 0) { // будим только если кто-то действительно спит
+            std::lock_guard<std::mutex> lk(idle_mtx);
+            ++wake_epoch;
+            cv.notify_one();
+        }
+    }
+
+    bool pop_or_wait(int id, T& out, std::atomic<int>& pending_dirs, std::atomic<bool>& stop_flag, PopInfo* info = nullptr) {
+        int victim = -1;
+        bool waited = false;
+        auto done = [&] {
+            if (info)
+                *info = PopInfo{ victim, waited };
+            return true;
+        };
+        while (true) {
+            if (try_pop(id, out, victim)) return done();
+            if (stop_flag.load() || pending_dirs.load() == 0) return false;
+
+            std::unique_lock<std::mutex> lk(idle_mtx);
+            sleeping.fetch_add(1);
+            // повторная проверка под idle_mtx: push, случившийся после неё, увидит sleeping > 0
+            // и сможет разбудить нас только после того, как мы уйдём в wait
+            if (try_pop(id, out, victim)) {
+                sleeping.fetch_sub(1);
+                return done();
+            }
+            const unsigned long long seen = wake_epoch;
+            waited = true;
+            cv.wait(lk, [&] { return wake_epoch != seen || stop_flag.load() || pending_dirs.load() == 0; });
+            sleeping.fetch_sub(1);
+        }
+    }
+
+    // поток id закончил каталог, взятый последним: место в пределе его группы освобождается
+    void release(int id) {
+        Local& own = locals[id];
+        if (!limited || !own.holds)
+            return;
+        own.holds = false;
+        active[own.group].fetch_sub(1);
+        if (sleeping.load() > 0) { // спящий мог упереться как раз в этот предел
+            std::lock_guard<std::mutex> lk(idle_mtx);
+            ++wake_epoch;
+            cv.notify_one();
+        }
+    }
+
+    // приблизительное число каталогов в очереди (для ограничения фронта)
+    size_t size() const { return queued.load(std::memory_order_relaxed); }
+
+    void notify_all() { // пробуждение всех потоков
+        std::lock_guard<std::mutex> lk(idle_mtx);
+        ++wake_epoch;
+        cv.notify_all();
+    }
+
+private:
+    // место в пределе группы; без пределов ничего не считается
+    bool reserve(unsigned g) {
+        if (!limited)
+            return true;
+        int a = active[g].load();
+        while (a < budget[g]) {
+            if (active[g].compare_exchange_weak(a, a + 1))
+                return true;
+        }
+        return false;
+    }
+
+    bool try_pop(int id, T& out, int& victim_id) {
+        Local& own = locals[id];
+        const size_t groups = budget.size();
+        {
+            std::lock_guard<std::mutex> lk(own.mtx);
+            // сначала группа текущего каталога: соседние каталоги того же устройства идут подряд
+            for (size_t k = 0; k < groups; ++k) {
+                const unsigned g = static_cast<unsigned>((own.group + k) % groups);
+                std::deque<T>& dq = own.dq[g];
+                if (dq.empty() || !reserve(g))
+                    continue;
+                const bool fifo = policy == Traversal::bfs || (policy == Traversal::hybrid && size() < hybrid_threshold);
+                if (fifo) {
+                    out = dq.front();
+                    dq.pop_front();
+                }
+                else {
+                    out = dq.back();
+                    dq.pop_back();
+                }
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                own.group = g;
+                own.holds = true;
+                victim_id = -1;
+                return true;
+            }
+        }
+        const int n = static_cast<int>(locals.size());
+        for (int i = 1; i < n; ++i) { // перехват у остальных потоков по кругу
+            const int v = (id + i) % n;
+            Local& victim = locals[v];
+            std::lock_guard<std::mutex> lk(victim.mtx);
+            for (size_t k = 0; k < groups; ++k) {
+                const unsigned g = static_cast<unsigned>((own.group + k) % groups);
+                std::deque<T>& dq = victim.dq[g];
+                if (dq.empty() || !reserve(g))
+                    continue;
+                out = dq.front();
+                dq.pop_front();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                own.group = g; // group и holds читает и пишет только сам поток id
+                own.holds = true;
+                victim_id = v;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct alignas(64) Local { // выравнивание, чтобы деки разных потоков не делили кэш-линию
+        std::vector<std::deque<T>> dq; // по деку на группу
+        std::mutex mtx;
+        unsigned group = 0;  // группа последнего взятого каталога; пишет только владелец
+        bool holds = false;  // занято место в пределе group
+    };
+
+    std::vector<Local> locals;
+    const Traversal policy;
+    const size_t hybrid_threshold;
+    const std::vector<int> budget;
+    const std::unique_ptr<std::atomic<int>[]> active; // потоков в каталогах группы
+    const bool limited;
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<int> sleeping{ 0 };
+    unsigned long long wake_epoch = 0; // защищён idle_mtx
+    std::mutex idle_mtx;
+    std::condition_variable cv;
+};
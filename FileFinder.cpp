@@ -4,8 +4,9 @@
 #include <filesystem>
 #include <thread>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 #include <atomic>
 #include <string>
@@ -15,215 +16,2559 @@
 #include <sstream>
 #include <chrono>
 #include <iomanip>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <cctype>
+#include <cwctype>
+#include <string_view>
+#include <functional>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <climits>
 
-namespace fs = std::filesystem;
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winioctl.h>
+#include "VolumeIndex.h"
+#else
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
 
-// сопоставление имени файла с шаблоном
-bool matchWildcard(const std::string& name, const std::string& pattern) {
-    size_t n = 0, p = 0;
-    size_t star = std::string::npos, match = 0;
+#include "Wildcard.h"
+#include "Log.h"
+#include "Trace.h"
+#include "FsWalk.h"
+#include "FinderEngine.h"
+#include "ListingCache.h"
 
-    while (n < name.size()) {
-        if (p < pattern.size() &&
-            (pattern[p] == '?' ||
-                std::tolower(static_cast<unsigned char>(pattern[p])) ==
-                std::tolower(static_cast<unsigned char>(name[n])))) {
-            ++n;
-            ++p;
+// метки времени для строк лога с результатами: дата и время до секунд пересчитываются
+// только при смене секунды, миллисекунды дописываются вручную
+class TimeFormatter {
+public:
+    void append(std::string& out, std::chrono::system_clock::time_point tp) {
+        const long long ms_total = std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+        const long long sec = ms_total / 1000;
+        if (sec != cached_sec) {
+            std::time_t t = static_cast<std::time_t>(sec);
+            std::tm local_tm;
+            localtime_s(&local_tm, &t);
+            char buf[32];
+            cached.assign(buf, std::strftime(buf, sizeof(buf), "%d-%m-%Y %H:%M:%S", &local_tm));
+            cached_sec = sec;
+        }
+        const int ms = static_cast<int>(ms_total % 1000);
+        const char tail[4] = { '.', static_cast<char>('0' + ms / 100), static_cast<char>('0' + ms / 10 % 10), static_cast<char>('0' + ms % 10) };
+        out += cached;
+        out.append(tail, sizeof(tail));
+    }
+
+private:
+    long long cached_sec = -1;
+    std::string cached;
+};
+
+// запись в stdout одним системным вызовом, без потоков ввода-вывода и преобразований локали
+void write_stdout(const std::string& text) {
+#ifdef _WIN32
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    size_t off = 0;
+    while (off < text.size()) {
+        DWORD written = 0;
+        const DWORD chunk = static_cast<DWORD>(std::min<size_t>(text.size() - off, 1u << 30));
+        if (!WriteFile(out, text.data() + off, chunk, &written, nullptr) || written == 0)
+            break;
+        off += written;
+    }
+#else
+    std::fwrite(text.data(), 1, text.size(), stdout);
+#endif
+}
+
+// формат вывода результатов
+enum class OutputFormat {
+    text,   // путь в кодировке консоли и перевод строки (как было)
+    nul,    // -0: путь UTF-8 и '\0', как find -print0
+    jsonl,  // --jsonl: по объекту JSON на строку с путём UTF-8, размером и временем изменения
+    binary, // --format=binary: длина пути (uint32 LE), номер шаблона (uint16 LE), путь UTF-8
+};
+
+// --sort: ключ упорядочивания вывода
+enum class SortKey { none, path, size, mtime };
+
+// приёмник результатов: каждый поток копит найденное в своём буфере и отдаёт его целиком,
+// когда тот заполнится; единственный поток-писатель забирает буферы из lock-free стека,
+// выводит их одним WriteFile и сам форматирует метки времени для лога.
+// С --sort буфер потока вместо вывода копит свой отсортированный отрезок, а finish сливает
+// отрезки всех потоков параллельным k-путевым слиянием и только тогда выводит
+class ResultSink {
+public:
+    static constexpr size_t flush_size = 1 << 16; // 64 КиБ текста на буфер
+
+    struct Batch {
+        struct Hit {
+            std::chrono::system_clock::time_point time;
+            uint32_t off;   // путь в out
+            uint32_t len;
+            int pattern;
+        };
+        std::string out;  // готовые строки для stdout
+        std::string logged; // пути для лога в --jsonl, где в out они экранированы; иначе путь берётся из out
+        std::vector<Hit> hits;
+        Batch* next = nullptr;
+    };
+
+    // найденный файл, ждущий сортировки
+    struct Record {
+        native_string path;
+        FileMeta meta;
+        int pattern;
+        bool has_meta;    // размер и время прочитаны; иначе в --jsonl этих полей нет
+        bool has_id;      // id прочитан (только с --unique)
+        DirIdentity id;
+        std::chrono::system_clock::time_point time;
+    };
+
+    // буфер одного потока
+    class Buffer {
+    public:
+        explicit Buffer(ResultSink& sink) : sink(sink) {}
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer() { flush(); }
+
+        // meta нужен только для --jsonl и --sort=size|mtime
+        void add(native_view path, int pattern, const FileMeta* meta = nullptr) {
+            if (sink.order != SortKey::none) {
+                Record r{ native_string(path), meta ? *meta : FileMeta{}, pattern, meta != nullptr, false, DirIdentity{}, std::chrono::system_clock::time_point{} };
+                if (sink.unique) // идентификатор читается здесь, в потоке обхода, а не при слиянии
+                    r.has_id = dir_identity(r.path, r.id);
+                if (sink.log_hits)
+                    r.time = std::chrono::system_clock::now();
+                run.push_back(std::move(r));
+                return;
+            }
+            if (!batch)
+                batch = std::make_unique<Batch>();
+            sink.format_hit(*batch, path, pattern, meta, sink.log_hits ? std::chrono::system_clock::now() : std::chrono::system_clock::time_point{});
+            if (batch->out.size() >= flush_size)
+                flush();
+        }
+
+        void flush() {
+            if (!run.empty())
+                sink.submit_run(std::exchange(run, {}));
+            if (batch)
+                sink.submit(batch.release());
+        }
+
+    private:
+        ResultSink& sink;
+        std::unique_ptr<Batch> batch;
+        std::vector<Record> run;
+    };
+
+    ResultSink(std::vector<std::string> names, OutputFormat format)
+        : pattern_names(std::move(names)), show_pattern(pattern_names.size() > 1),
+          log_hits(logger.enabled(LogLevel::info)), format(format) {
+        if (format == OutputFormat::jsonl) {
+            for (const std::string& p : pattern_names)
+                utf8_patterns.push_back(fs::path(p).u8string());
+        }
+    }
+
+    ~ResultSink() { finish(); }
+
+    // --sort: вызывается до start; limit < 0 — выводить всё, unique — один путь на файл
+    void sort_by(SortKey key, long long limit, bool drop_duplicates, int merge_threads) {
+        order = key;
+        sorted_limit = limit;
+        unique = drop_duplicates;
+        threads = std::max(1, merge_threads);
+    }
+
+    // нужны ли приёмнику размер и время найденного файла
+    bool wants_meta() const { return format == OutputFormat::jsonl || order == SortKey::size || order == SortKey::mtime; }
+
+    void start() { writer = std::thread(&ResultSink::run, this); }
+
+    // вызывается, когда все потоки, писавшие в буферы, уже завершились
+    void finish() {
+        if (order != SortKey::none && !merged) {
+            merged = true;
+            write_sorted();
+        }
+        done.store(true);
+        cv.notify_one();
+        if (writer.joinable())
+            writer.join();
+    }
+
+private:
+    // строка вывода в формате format и отметка для лога
+    void format_hit(Batch& batch, native_view path, int pattern, const FileMeta* meta, std::chrono::system_clock::time_point time) {
+        std::string& out = batch.out;
+        size_t hit_off = format == OutputFormat::jsonl ? batch.logged.size() : out.size();
+        size_t hit_len = 0;
+        switch (format) {
+        case OutputFormat::text:
+#ifdef _WIN32
+            // path_string не бросает: у потоков --mft, --index, iocp и --contains нет catch на каталог,
+            // и имя вне кодовой страницы консоли выводится с '?' вместо того, чтобы завершить программу
+            out += path_string(path);
+#else
+            out += path;
+#endif
+            hit_len = out.size() - hit_off;
+            if (show_pattern) {
+                out += '\t';
+                out += pattern_names[pattern];
+            }
+            out += '\n';
+            break;
+        case OutputFormat::nul:
+            append_utf8(out, path);
+            hit_len = out.size() - hit_off;
+            out += '\0';
+            break;
+        case OutputFormat::jsonl:
+            append_utf8(batch.logged, path);
+            hit_len = batch.logged.size() - hit_off;
+            out += "{\"path\":\"";
+            append_json(out, std::string_view(batch.logged).substr(hit_off));
+            out += '"';
+            if (meta) {
+                out += ",\"size\":";
+                out += std::to_string(meta->size);
+                out += ",\"mtime\":";
+                out += std::to_string(meta->mtime);
+            }
+            if (show_pattern) {
+                out += ",\"pattern\":\"";
+                append_json(out, utf8_patterns[pattern]);
+                out += '"';
+            }
+            out += "}\n";
+            break;
+        case OutputFormat::binary: {
+            const size_t head = out.size();
+            out.append(6, '\0'); // заголовок записи заполняется, когда известна длина пути
+            hit_off = out.size();
+            append_utf8(out, path);
+            hit_len = out.size() - hit_off;
+            const uint32_t len = static_cast<uint32_t>(hit_len);
+            const unsigned idx = static_cast<unsigned>(pattern);
+            const unsigned char prefix[6] = { static_cast<unsigned char>(len), static_cast<unsigned char>(len >> 8),
+                static_cast<unsigned char>(len >> 16), static_cast<unsigned char>(len >> 24),
+                static_cast<unsigned char>(idx), static_cast<unsigned char>(idx >> 8) };
+            std::memcpy(&out[head], prefix, sizeof(prefix));
+            break;
+        }
+        }
+        if (log_hits)
+            batch.hits.push_back({ time, static_cast<uint32_t>(hit_off), static_cast<uint32_t>(hit_len), pattern });
+    }
+
+    // длина корректной последовательности UTF-8 в начале s (1..4) или 0, если байты не UTF-8:
+    // обрыв, лишний продолжающий байт, избыточная запись, суррогат или код больше U+10FFFF
+    static size_t utf8_sequence(std::string_view s) {
+        const unsigned char u = static_cast<unsigned char>(s[0]);
+        if (u < 0x80)
+            return 1;
+        size_t len;
+        unsigned char lo = 0x80, hi = 0xBF; // допустимые значения второго байта
+        if (u >= 0xC2 && u <= 0xDF) {
+            len = 2;
         }
-        else if (p < pattern.size() && pattern[p] == '*') {
-            star = p++;
-            match = n;
+        else if (u >= 0xE0 && u <= 0xEF) {
+            len = 3;
+            if (u == 0xE0)
+                lo = 0xA0;
+            else if (u == 0xED)
+                hi = 0x9F;
         }
-        else if (star != std::string::npos) {
-            p = star + 1;
-            n = ++match;
+        else if (u >= 0xF0 && u <= 0xF4) {
+            len = 4;
+            if (u == 0xF0)
+                lo = 0x90;
+            else if (u == 0xF4)
+                hi = 0x8F;
         }
         else {
-            return false;
+            return 0;
+        }
+        if (s.size() < len)
+            return 0;
+        const unsigned char second = static_cast<unsigned char>(s[1]);
+        if (second < lo || second > hi)
+            return 0;
+        for (size_t i = 2; i < len; ++i)
+            if ((static_cast<unsigned char>(s[i]) & 0xC0) != 0x80)
+                return 0;
+        return len;
+    }
+
+    // строка JSON без кавычек: экранируются кавычка, обратная косая черта и управляющие символы.
+    // Имена вне Windows — произвольные байты; что не складывается в UTF-8, заменяется на U+FFFD,
+    // иначе строка --jsonl не была бы корректным JSON
+    static void append_json(std::string& out, std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        while (!s.empty()) {
+            const char c = s[0];
+            const unsigned char u = static_cast<unsigned char>(c);
+            size_t len = 1;
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (u < 0x20) {
+                const char esc[6] = { '\\', 'u', '0', '0', hex[u >> 4], hex[u & 15] };
+                out.append(esc, sizeof(esc));
+            }
+            else if (u < 0x80) {
+                out += c;
+            }
+            else if ((len = utf8_sequence(s)) != 0) {
+                out.append(s.data(), len);
+            }
+            else {
+                out += "\xEF\xBF\xBD";
+                len = 1;
+            }
+            s.remove_prefix(len);
+        }
+    }
+
+    void submit(Batch* b) {
+        b->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {}
+        cv.notify_one();
+    }
+
+    // порядок --sort: по ключу, при равенстве по пути, поэтому копии одного пути всегда соседние
+    bool less(const Record& a, const Record& b) const {
+        switch (order) {
+        case SortKey::size:
+            if (a.meta.size != b.meta.size)
+                return a.meta.size < b.meta.size;
+            break;
+        case SortKey::mtime:
+            if (a.meta.mtime != b.meta.mtime)
+                return a.meta.mtime < b.meta.mtime;
+            break;
+        default:
+            break;
         }
+        return a.path < b.path;
     }
 
-    while (p < pattern.size() && pattern[p] == '*')
-        ++p;
+    // отрезок сортируется в потоке, который его накопил
+    void submit_run(std::vector<Record> records) {
+        std::sort(records.begin(), records.end(), [this](const Record& a, const Record& b) { return less(a, b); });
+        std::lock_guard<std::mutex> lk(runs_mtx);
+        runs.push_back(std::move(records));
+    }
+
+    // k-путевое слияние отрезков: диапазон ключей делится разделителями из равномерной выборки
+    // по всем отрезкам на threads частей, и каждая часть сливается через кучу в своё место результата
+    std::vector<Record> merge_runs() {
+        size_t total = 0;
+        for (const auto& r : runs)
+            total += r.size();
+        if (runs.size() == 1)
+            return std::move(runs[0]);
+
+        const auto cmp = [this](const Record& a, const Record& b) { return less(a, b); };
+        const size_t parts = std::clamp<size_t>(total / 65536, 1, static_cast<size_t>(threads));
+        std::vector<const Record*> splitters;
+        if (parts > 1) {
+            std::vector<const Record*> samples;
+            for (const auto& r : runs) {
+                for (size_t i = 1; i <= parts * 4; ++i) {
+                    const size_t at = r.size() * i / (parts * 4 + 1);
+                    if (at < r.size())
+                        samples.push_back(&r[at]);
+                }
+            }
+            std::sort(samples.begin(), samples.end(), [&](const Record* a, const Record* b) { return cmp(*a, *b); });
+            for (size_t p = 1; p < parts; ++p)
+                splitters.push_back(samples[samples.size() * p / parts]);
+        }
+
+        // bounds[p][k] — начало части p в отрезке k; последняя строка — концы отрезков
+        std::vector<std::vector<size_t>> bounds(parts + 1, std::vector<size_t>(runs.size(), 0));
+        for (size_t k = 0; k < runs.size(); ++k) {
+            for (size_t p = 1; p < parts; ++p)
+                bounds[p][k] = std::lower_bound(runs[k].begin(), runs[k].end(), *splitters[p - 1], cmp) - runs[k].begin();
+            bounds[parts][k] = runs[k].size();
+        }
+
+        std::vector<Record> merged_out(total);
+        auto merge_part = [&](size_t p) {
+            size_t at = 0;
+            for (size_t q = 0; q < p; ++q)
+                for (size_t k = 0; k < runs.size(); ++k)
+                    at += bounds[q + 1][k] - bounds[q][k];
+            using Cursor = std::pair<size_t, size_t>; // отрезок, позиция
+            auto heap_cmp = [&](const Cursor& a, const Cursor& b) { return cmp(runs[b.first][b.second], runs[a.first][a.second]); };
+            std::vector<Cursor> heap;
+            for (size_t k = 0; k < runs.size(); ++k) {
+                if (bounds[p][k] < bounds[p + 1][k])
+                    heap.emplace_back(k, bounds[p][k]);
+            }
+            std::make_heap(heap.begin(), heap.end(), heap_cmp);
+            while (!heap.empty()) {
+                std::pop_heap(heap.begin(), heap.end(), heap_cmp);
+                Cursor& c = heap.back();
+                merged_out[at++] = std::move(runs[c.first][c.second]);
+                if (++c.second < bounds[p + 1][c.first])
+                    std::push_heap(heap.begin(), heap.end(), heap_cmp);
+                else
+                    heap.pop_back();
+            }
+        };
+        std::vector<std::thread> pool;
+        for (size_t p = 1; p < parts; ++p)
+            pool.emplace_back(merge_part, p);
+        merge_part(0);
+        for (std::thread& t : pool)
+            t.join();
+        return merged_out;
+    }
+
+    // слияние, удаление повторов и вывод через обычный поток-писатель
+    void write_sorted() {
+        if (runs.empty())
+            return;
+        const auto t0 = std::chrono::steady_clock::now();
+        const size_t run_count = runs.size();
+        std::vector<Record> all = merge_runs();
+        runs.clear();
+        LOG_INFO("Sorted " + std::to_string(all.size()) + " matches from " + std::to_string(run_count) + " runs in " +
+            std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()) + " ms");
+
+        // повтор — тот же путь или, с --unique, тот же файл под другим путём; остаётся первый по порядку
+        std::unordered_set<DirIdentity, VisitedDirs::Hash> seen;
+        std::unique_ptr<Batch> batch;
+        long long written = 0;
+        const Record* prev = nullptr;
+        for (const Record& r : all) {
+            if (sorted_limit >= 0 && written >= sorted_limit)
+                break;
+            if (prev && prev->path == r.path)
+                continue;
+            prev = &r;
+            if (r.has_id && !seen.insert(r.id).second)
+                continue;
+            if (!batch)
+                batch = std::make_unique<Batch>();
+            format_hit(*batch, r.path, r.pattern, r.has_meta ? &r.meta : nullptr, r.time);
+            ++written;
+            if (batch->out.size() >= flush_size)
+                submit(batch.release());
+        }
+        if (batch)
+            submit(batch.release());
+    }
+
+    void run() {
+        TimeFormatter tf;
+        std::string out_text, log_text;
+        while (true) {
+            Batch* list = head.exchange(nullptr, std::memory_order_acquire);
+            if (!list) {
+                if (done.load()) {
+                    list = head.exchange(nullptr, std::memory_order_acquire);
+                    if (!list)
+                        break;
+                }
+                else {
+                    std::unique_lock<std::mutex> lk(wait_mtx);
+                    cv.wait_for(lk, std::chrono::milliseconds(20));
+                    continue;
+                }
+            }
+
+            // стек отдаёт батчи в обратном порядке
+            Batch* ordered = nullptr;
+            while (list) {
+                Batch* next = list->next;
+                list->next = ordered;
+                ordered = list;
+                list = next;
+            }
+
+            out_text.clear();
+            log_text.clear();
+            while (ordered) {
+                std::unique_ptr<Batch> b(ordered);
+                ordered = b->next;
+                out_text += b->out;
+                for (const Batch::Hit& h : b->hits) {
+                    log_text += "Time: ";
+                    tf.append(log_text, h.time);
+                    log_text += " | Path: ";
+                    log_text.append(format == OutputFormat::jsonl ? b->logged : b->out, h.off, h.len);
+                    if (show_pattern) {
+                        log_text += " | Pattern: ";
+                        log_text += pattern_names[h.pattern];
+                    }
+                    log_text += '\n';
+                }
+            }
+            write_stdout(out_text);
+            if (!log_text.empty()) {
+                log_text.pop_back(); // последний перевод строки добавит лог
+                logger.write_raw(std::move(log_text));
+                log_text = std::string();
+            }
+        }
+#ifndef _WIN32
+        std::fflush(stdout);
+#endif
+    }
+
+    const std::vector<std::string> pattern_names;
+    const bool show_pattern;
+    const bool log_hits; // строки с результатами пишутся в лог только на уровне info и выше
+    const OutputFormat format; // вне text пути в логе тоже в UTF-8, как в выводе
+    std::vector<std::string> utf8_patterns; // имена шаблонов для --jsonl
+    SortKey order = SortKey::none;
+    long long sorted_limit = -1;
+    bool unique = false;
+    int threads = 1;      // потоков слияния
+    bool merged = false;
+    std::vector<std::vector<Record>> runs; // отсортированные отрезки буферов
+    std::mutex runs_mtx;
+    std::atomic<Batch*> head{ nullptr };
+    std::atomic<bool> done{ false };
+    std::mutex wait_mtx; // только для ожидания писателя, производители его не берут
+    std::condition_variable cv;
+    std::thread writer;
+};
 
-    return p == pattern.size();
+// сводка --stats в stderr: по потокам, итог, задержки каталогов и глубина очереди
+void print_walk_stats(const std::vector<WalkCounters>& all, const LatencyHistogram& queue_depth, double wall_s) {
+    const WalkTotals total(all);
+    auto ms = [](uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1e3; };
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1);
+    oss << "\nСтатистика обхода (" << wall_s << " с):\n"
+        << "  поток   каталогов     записей  совпадений  ожидание, мс  перечисление, мс  ошибок\n";
+    auto row = [&](const std::string& name, uint64_t dirs, uint64_t entries, uint64_t matches, uint64_t wait, uint64_t scan, uint64_t errors) {
+        oss << "  " << std::setw(5) << name << std::setw(12) << dirs << std::setw(12) << entries << std::setw(12) << matches
+            << std::setw(14) << ms(wait) << std::setw(18) << ms(scan) << std::setw(8) << errors << "\n";
+    };
+    for (size_t i = 0; i < all.size(); ++i) {
+        const WalkCounters& c = all[i];
+        uint64_t errors = 0;
+        for (const StatCounter& e : c.errors)
+            errors += e.get();
+        row(std::to_string(i), c.dirs.get(), c.entries.get(), c.matches.get(), c.wait_ns.get(), c.scan_ns.get(), errors);
+    }
+    uint64_t errors = 0;
+    for (uint64_t e : total.errors)
+        errors += e;
+    row("всего", total.dirs, total.entries, total.matches, total.wait_ns, total.scan_ns, errors);
+    if (wall_s > 0)
+        oss << "  скорость: " << static_cast<uint64_t>(total.dirs / wall_s) << " каталогов/с, "
+            << static_cast<uint64_t>(total.entries / wall_s) << " записей/с\n";
+    if (total.latency.count() > 0)
+        oss << "  каталог из очереди, мкс: p50 " << us(total.latency.percentile(0.50)) << ", p90 " << us(total.latency.percentile(0.90))
+            << ", p99 " << us(total.latency.percentile(0.99)) << ", p99.9 " << us(total.latency.percentile(0.999))
+            << ", max " << us(total.latency.max()) << "\n";
+    if (queue_depth.count() > 0)
+        oss << "  глубина очереди (" << queue_depth.count() << " замеров): p50 " << queue_depth.percentile(0.50)
+            << ", p99 " << queue_depth.percentile(0.99) << ", max " << queue_depth.max() << "\n";
+    if (total.revisits > 0)
+        oss << "  пропущено повторов и циклов по ссылкам: " << total.revisits << "\n";
+    if (total.cached > 0)
+        oss << "  из кэша списков, без перечисления: " << total.cached << " каталогов\n";
+    oss << "  ошибки: нет доступа " << total.errors[0] << ", не найдено " << total.errors[1]
+        << ", прочие ФС " << total.errors[2] << ", исключения " << total.errors[3] << "\n";
+    std::cerr << oss.str();
 }
 
-std::mutex log_mtx; // мьютекс для лога
-std::ofstream log_file; // лог файл
-std::atomic<bool> any_file_found{ false };  // найден ли хотя бы один файл
+#ifdef _WIN32
+// асинхронный обход через порт завершения: NtQueryDirectoryFile на дескрипторах с
+// FILE_FLAG_OVERLAPPED, до depth запросов в полёте одновременно на num_threads потоках.
+// На SMB каждый запрос — сетевой круговой рейс, и держать их много в полёте выгоднее,
+// чем блокировать по потоку на каждый
+using nt_status = LONG;
 
-std::string get_current_time() {
-    auto now = std::chrono::system_clock::now();
-    auto time_t_now = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+// раскладка IO_STATUS_BLOCK совпадает с полями Internal/InternalHigh у OVERLAPPED
+struct NtIoStatus {
+    union {
+        nt_status Status;
+        PVOID Pointer;
+    };
+    ULONG_PTR Information;
+};
+
+// FILE_DIRECTORY_INFORMATION из ntifs.h
+struct NtDirectoryInfo {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+};
+
+using NtQueryDirectoryFileFn = nt_status(NTAPI*)(HANDLE file, HANDLE event, PVOID apc_routine, PVOID apc_context,
+    NtIoStatus* io_status, PVOID info, ULONG length, int info_class, BOOLEAN single_entry, PVOID file_name, BOOLEAN restart_scan);
 
-    std::tm local_tm;  // структура для локального времени
-    localtime_s(&local_tm, &time_t_now);
+constexpr nt_status nt_status_pending = 0x00000103;
+constexpr int nt_file_directory_information = 1;
+constexpr DWORD iocp_buffer_size = 1 << 16; // буфер одного запроса; SMB всё равно режет ответ до ~64 КиБ
 
+inline bool nt_error(nt_status s) { return (static_cast<ULONG>(s) >> 30) == 3; }
+
+inline std::string nt_status_text(nt_status s) {
     std::ostringstream oss;
-    oss << std::put_time(&local_tm, "%d-%m-%Y %H:%M:%S");
-    oss << '.' << std::setprecision(3) << std::fixed << ms.count();
+    oss << "status 0x" << std::hex << static_cast<ULONG>(s);
     return oss.str();
 }
 
-// точка отсчёта времени — запуск main
-const auto program_start = std::chrono::high_resolution_clock::now();
+template <class OnMatch>
+bool search_iocp(const fs::path& start_path, const NativePatterns& patterns, const MetaFilter& filter, const Pruner& prune,
+    LinkPolicy links, VisitedDirs* visited, int num_threads, int depth,
+    const std::atomic<bool>& stop, ResultSink& sink, OnMatch&& on_match) {
+    static const auto query = reinterpret_cast<NtQueryDirectoryFileFn>(
+        GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQueryDirectoryFile"));
+    if (!query) {
+        LOG_WARN("NtQueryDirectoryFile unavailable, falling back to blocking workers");
+        return false;
+    }
+
+    HandleGuard port;
+    port.h = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, static_cast<DWORD>(num_threads));
+    if (!port.h) {
+        port.h = INVALID_HANDLE_VALUE;
+        LOG_WARN("CreateIoCompletionPort failed: " + std::to_string(GetLastError()));
+        return false;
+    }
+
+    // один каталог в полёте; по OVERLAPPED из порта запрос находится через CONTAINING_RECORD
+    struct Request {
+        OVERLAPPED ov{};
+        HANDLE dir = INVALID_HANDLE_VALUE;
+        const DirNode* node = nullptr;
+        std::wstring path;
+        std::vector<ULONGLONG> buffer = std::vector<ULONGLONG>(iocp_buffer_size / sizeof(ULONGLONG));
+    };
+
+    constexpr ULONG_PTR exit_key = 1;
+    std::mutex mtx;                                  // защищает всё, что ниже, до arenas
+    std::vector<const DirNode*> waiting;             // каталоги, ещё не открытые (LIFO — обход в глубину)
+    std::vector<std::unique_ptr<Request>> free_reqs; // повторно используемые запросы с буферами
+    int in_flight = 0;
+    size_t unfinished = 1;                           // ждущие + в полёте; 0 — обход закончен
+    std::vector<PathArena> arenas(num_threads);
+
+    const DirNode* root = arenas[0].make(nullptr, start_path.native());
+    waiting.push_back(root);
+
+    // каталог закончен (или не открылся); вызывается под mtx
+    auto finish_dir = [&] {
+        if (--unfinished == 0) {
+            for (int i = 0; i < num_threads; ++i)
+                PostQueuedCompletionStatus(port.h, 0, exit_key, nullptr);
+        }
+    };
+
+    // первый или очередной запрос к каталогу; false — запрос не ушёл и пакета в порт не будет
+    auto issue = [&](Request* r, bool restart) {
+        r->ov = OVERLAPPED{};
+        const nt_status s = query(r->dir, nullptr, nullptr, &r->ov, reinterpret_cast<NtIoStatus*>(&r->ov.Internal),
+            r->buffer.data(), iocp_buffer_size, nt_file_directory_information, FALSE, nullptr, restart);
+        // успех и предупреждения (в том числе STATUS_NO_MORE_FILES) приходят пакетом в порт, ошибки — только кодом возврата
+        if (nt_error(s)) {
+            constexpr nt_status no_such_file = static_cast<nt_status>(0xC000000F);
+            if (s != no_such_file)
+                LOG_WARN("NtQueryDirectoryFile failed in " + path_string(r->path) + ": " + nt_status_text(s));
+            return false;
+        }
+        return true;
+    };
+
+    auto release = [&](std::unique_ptr<Request> r) { // под mtx
+        CloseHandle(r->dir);
+        r->dir = INVALID_HANDLE_VALUE;
+        --in_flight;
+        free_reqs.push_back(std::move(r));
+        finish_dir();
+    };
+
+    // открытие ждущих каталогов, пока есть свободные места в полёте; берёт и отпускает mtx сам
+    auto pump = [&] {
+        std::unique_lock<std::mutex> lk(mtx);
+        while (in_flight < depth && !waiting.empty()) {
+            if (stop.load(std::memory_order_relaxed)) {
+                for (size_t n = waiting.size(); n > 0; --n)
+                    finish_dir();
+                waiting.clear();
+                break;
+            }
+            const DirNode* node = waiting.back();
+            waiting.pop_back();
+            std::unique_ptr<Request> r;
+            if (!free_reqs.empty()) {
+                r = std::move(free_reqs.back());
+                free_reqs.pop_back();
+            }
+            else {
+                r = std::make_unique<Request>();
+            }
+            ++in_flight;
+            lk.unlock();
+
+            // CreateFileW синхронный и на SMB тоже стоит кругового рейса, поэтому без блокировки
+            r->node = node;
+            node->path(r->path);
+            LOG_DEBUG("Directory: " + path_string(r->path));
+            r->dir = CreateFileW(r->path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+            bool started = false;
+            if (r->dir == INVALID_HANDLE_VALUE) {
+                const DWORD err = GetLastError();
+                if (err != ERROR_ACCESS_DENIED)
+                    LOG_WARN("Access denied or error in directory: " + path_string(r->path) + " - CreateFileW error " + std::to_string(err));
+            }
+            else if (DirIdentity ident; visited && dir_identity(r->dir, ident) && !visited->insert(ident)) {
+                LOG_DEBUG("Already visited: " + path_string(r->path));
+            }
+            else if (!CreateIoCompletionPort(r->dir, port.h, 0, 0)) {
+                LOG_WARN("Cannot attach directory to completion port: " + path_string(r->path));
+            }
+            else {
+                started = issue(r.get(), TRUE);
+            }
+            if (started)
+                r.release(); // владение переходит к пакету в порту
+            lk.lock();
+            if (!started) {
+                if (r->dir == INVALID_HANDLE_VALUE) {
+                    --in_flight;
+                    free_reqs.push_back(std::move(r));
+                    finish_dir();
+                }
+                else {
+                    release(std::move(r));
+                }
+            }
+        }
+    };
+
+    auto run = [&](int id) {
+        ResultSink::Buffer out(sink);
+        PathArena& arena = arenas[id];
+        std::wstring full;
+        std::vector<const DirNode*> found; // подкаталоги из одного ответа, добавляются в waiting разом
+        while (true) {
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            OVERLAPPED* ov = nullptr;
+            GetQueuedCompletionStatus(port.h, &bytes, &key, &ov, INFINITE);
+            if (key == exit_key || !ov)
+                break;
+
+            // у запроса в каждый момент один владелец: пакет в порту или поток, который его достал.
+            // После issue(), вернувшего true, следующий пакет того же каталога может уже обрабатывать
+            // другой поток и даже вызвать release(), поэтому всё, что относится к этому ответу,
+            // делается до issue(): подкаталоги прибавляются к unfinished под mtx раньше, чем каталог
+            // может быть закончен, и unfinished не обнуляется, пока работа есть. Пакеты exit_key
+            // уходят в порт последними: к этому моменту все запросы уже вернулись в free_reqs,
+            // а узлы в arenas живут до выхода из функции
+            std::unique_ptr<Request> r(CONTAINING_RECORD(ov, Request, ov));
+            const nt_status s = static_cast<nt_status>(r->ov.Internal);
+            const ULONG_PTR size = r->ov.InternalHigh;
+            bool more = !nt_error(s) && size > 0 && !stop.load(std::memory_order_relaxed);
+
+            found.clear();
+            if (more) {
+                const unsigned char* p = reinterpret_cast<const unsigned char*>(r->buffer.data());
+                while (true) {
+                    const auto* info = reinterpret_cast<const NtDirectoryInfo*>(p);
+                    std::wstring_view name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                    if (name != L"." && name != L"..") {
+                        // в FILE_DIRECTORY_INFORMATION нет тега точки повторного анализа,
+                        // поэтому ссылкой считается любой каталог с FILE_ATTRIBUTE_REPARSE_POINT
+                        const bool link = (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+                        if ((info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (links == LinkPolicy::always || !link)) {
+                            if (!prune.skip_dir(r->node, name))
+                                found.push_back(arena.make(r->node, name));
+                        }
+                        else {
+                            const int matched = patterns.match(name);
+                            if (matched >= 0 && !prune.skip_file(r->node, name) && (!filter.active() || filter.match(FileMeta{ static_cast<uint64_t>(info->EndOfFile.QuadPart),
+                                    filetime_to_unix(info->LastWriteTime.QuadPart), info->FileAttributes }))) {
+                                full.assign(r->path);
+                                append_component(full, name);
+                                on_match(out, full, matched);
+                            }
+                        }
+                    }
+                    if (info->NextEntryOffset == 0)
+                        break;
+                    p += info->NextEntryOffset;
+                }
+            }
+            else if (nt_error(s)) {
+                LOG_WARN("Directory query failed in " + path_string(r->path) + ": " + nt_status_text(s));
+            }
+
+            if (!found.empty()) {
+                std::lock_guard<std::mutex> lk(mtx);
+                if (!stop.load(std::memory_order_relaxed)) {
+                    waiting.insert(waiting.end(), found.begin(), found.end());
+                    unfinished += found.size();
+                }
+            }
+            if (more)
+                more = issue(r.get(), FALSE); // продолжение того же каталога
+            if (more) {
+                r.release(); // владение снова у пакета в порту, *r больше не трогаем
+            }
+            else {
+                std::lock_guard<std::mutex> lk(mtx);
+                release(std::move(r));
+            }
+            pump();
+        }
+    };
+
+    pump();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i)
+        threads.emplace_back(run, i);
+    for (auto& t : threads)
+        t.join();
+    return true;
+}
+
+// поиск по индексу тома: вместо обхода каталогов — проход по плоскому массиву записей,
+// полные пути собираются по цепочке родителей только для совпадений;
+// в индексе из метаданных есть только атрибуты: фильтры по размеру и времени отсекаются ещё в main
+template <class OnMatch>
+bool search_index(const IndexView& index, const fs::path& start_path, const NativePatterns& patterns, const MetaFilter& filter, int num_threads,
+    const std::atomic<bool>& stop, ResultSink& sink, OnMatch&& on_match) {
+    uint64_t base_frn = 0;
+    if (std::error_code ec = file_reference(start_path.native(), base_frn)) {
+        LOG_WARN("Cannot read file reference of start path, falling back to directory walk: " + ec.message());
+        return false;
+    }
+
+    // массив записей делится на равные куски между потоками
+    auto scan_range = [&](size_t begin, size_t end) {
+        ResultSink::Buffer out(sink);
+        std::wstring rel, full;
+        for (size_t i = begin; i < end; ++i) {
+            if ((i & 0xFFF) == 0 && stop.load(std::memory_order_relaxed))
+                return;
+            const VolumeRecord& r = index.begin()[i];
+            if (r.attrs & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+            const int matched = patterns.match(index.name(r));
+            if (matched >= 0 && (!filter.active() || filter.match(FileMeta{ 0, 0, r.attrs })) && index.relative_path(r, base_frn, rel)) {
+                full.assign(start_path.native());
+                append_component(full, rel);
+                on_match(out, full, matched);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    const size_t chunk = (index.size() + num_threads - 1) / num_threads;
+    for (size_t begin = 0; begin < index.size(); begin += chunk)
+        threads.emplace_back(scan_range, begin, std::min(index.size(), begin + chunk));
+    for (auto& t : threads)
+        t.join();
+    return true;
+}
+
+// поиск по MFT, прочитанной при запуске; false, если том не NTFS или нет прав
+template <class OnMatch>
+bool search_mft(const fs::path& start_path, const NativePatterns& patterns, const MetaFilter& filter, int num_threads,
+    const std::atomic<bool>& stop, ResultSink& sink, OnMatch&& on_match) {
+    const auto t0 = std::chrono::steady_clock::now();
+    VolumeIndex index;
+    if (std::error_code ec = index.load(start_path.native())) {
+        LOG_WARN("MFT index unavailable, falling back to directory walk: " + ec.message());
+        return false;
+    }
+    LOG_INFO("MFT records: " + std::to_string(index.view().size()) + ", loaded in " +
+        std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()) + " ms");
+    return search_index(index.view(), start_path, patterns, filter, num_threads, stop, sink, on_match);
+}
+
+// построение файла индекса или его обновление по журналу USN, если файл уже есть
+bool build_index(const fs::path& start_path, const fs::path& file) {
+    const auto t0 = std::chrono::steady_clock::now();
+    uint32_t serial = 0;
+    if (std::error_code ec = volume_serial(start_path.native(), serial)) {
+        LOG_ERROR("Cannot query volume of start path: " + ec.message());
+        std::cerr << "Ошибка: не удалось определить том для " << start_path << ": " << ec.message() << "\n";
+        return false;
+    }
+
+    VolumeIndex index;
+    bool refreshed = false;
+    if (!index.read(file.native()) && index.header().volume_serial == serial) {
+        const int64_t from_usn = index.header().next_usn;
+        if (std::error_code ec = index.refresh()) {
+            LOG_INFO("USN journal cannot be replayed, rebuilding index: " + ec.message());
+        }
+        else {
+            refreshed = true;
+            LOG_INFO("Index refreshed from USN " + std::to_string(from_usn) + " to " + std::to_string(index.header().next_usn));
+        }
+    }
+    if (!refreshed) {
+        if (std::error_code ec = index.load(start_path.native())) {
+            LOG_ERROR("Cannot read MFT: " + ec.message());
+            std::cerr << "Ошибка: не удалось прочитать MFT (нужен том NTFS и права администратора): " << ec.message() << "\n";
+            return false;
+        }
+        LOG_INFO("Index rebuilt from MFT");
+    }
+
+    if (std::error_code ec = index.save(file.native())) {
+        LOG_ERROR("Cannot write index file: " + ec.message());
+        std::cerr << "Ошибка: не удалось записать индекс " << file << ": " << ec.message() << "\n";
+        return false;
+    }
+    LOG_INFO("Index records: " + std::to_string(index.view().size()) + ", done in " +
+        std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()) + " ms");
+    return true;
+}
+
+// поиск по ранее построенному файлу индекса, отображённому в память
+template <class OnMatch>
+bool search_index_file(const fs::path& file, const fs::path& start_path, const NativePatterns& patterns, const MetaFilter& filter, int num_threads,
+    const std::atomic<bool>& stop, ResultSink& sink, OnMatch&& on_match) {
+    MappedIndex mapped;
+    if (std::error_code ec = mapped.open(file.native())) {
+        LOG_ERROR("Cannot open index file: " + ec.message());
+        std::cerr << "Ошибка: не удалось открыть индекс " << file << ": " << ec.message() << "\n";
+        return false;
+    }
+    uint32_t serial = 0;
+    if (volume_serial(start_path.native(), serial) || serial != mapped.header().volume_serial) {
+        LOG_ERROR("Index file belongs to another volume");
+        std::cerr << "Ошибка: индекс " << file << " построен для другого тома\n";
+        return false;
+    }
+    LOG_INFO("Index records: " + std::to_string(mapped.view().size()) + ", next USN " + std::to_string(mapped.header().next_usn));
+    return search_index(mapped.view(), start_path, patterns, filter, num_threads, stop, sink, on_match);
+}
+#endif
+
+constexpr size_t content_chunk = 1 << 20; // кусок потокового чтения содержимого
+
+// поиск подстроки в файле потоковым чтением; хвост предыдущего куска
+// переносится в начало следующего, чтобы не пропустить вхождение на стыке
+inline bool stream_contains(const fs::path& file, std::string_view needle, const std::atomic<bool>& stop, bool& ok) {
+    std::ifstream in(file, std::ios::binary);
+    ok = static_cast<bool>(in);
+    if (!ok || needle.empty())
+        return ok;
+    thread_local std::vector<char> buffer;
+    buffer.resize(content_chunk + needle.size());
+    size_t kept = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        in.read(buffer.data() + kept, static_cast<std::streamsize>(content_chunk));
+        const size_t got = static_cast<size_t>(in.gcount());
+        if (got == 0)
+            break;
+        const size_t n = kept + got;
+        if (simd::contains_bytes(buffer.data(), n, needle.data(), needle.size()))
+            return true;
+        kept = std::min(n, needle.size() - 1);
+        std::memmove(buffer.data(), buffer.data() + n - kept, kept);
+    }
+    ok = !in.bad();
+    return false;
+}
+
+#ifdef _WIN32
+// отдельно от file_contains: __try не допускается в функциях с объектами, требующими раскрутки
+inline bool mapped_contains(const char* data, size_t n, std::string_view needle, bool& ok) {
+    __try { // файл могли обрезать после отображения: чтение за концом даёт исключение, а не мусор
+        return simd::contains_bytes(data, n, needle.data(), needle.size());
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        ok = false;
+        return false;
+    }
+}
 
-// логирование
-void log(const std::string& msg) {
-    std::lock_guard<std::mutex> lk(log_mtx);
-    log_file << msg << std::endl;
+// на Windows файл отображается в память целиком; если отображение не удалось
+// (например, файл больше адресного пространства x86), читается потоком
+inline bool file_contains(const native_string& path, std::string_view needle, const std::atomic<bool>& stop, bool& ok) {
+    HandleGuard file;
+    file.h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    ok = file.h != INVALID_HANDLE_VALUE;
+    LARGE_INTEGER size{};
+    if (!ok || !GetFileSizeEx(file.h, &size))
+        return ok = false;
+    if (size.QuadPart == 0)
+        return needle.empty();
+    if (static_cast<unsigned long long>(size.QuadPart) > SIZE_MAX)
+        return stream_contains(path, needle, stop, ok);
+
+    HandleGuard mapping;
+    mapping.h = CreateFileMappingW(file.h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping.h) {
+        mapping.h = INVALID_HANDLE_VALUE;
+        return stream_contains(path, needle, stop, ok);
+    }
+    const void* view = MapViewOfFile(mapping.h, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+        return stream_contains(path, needle, stop, ok);
+    const bool found = mapped_contains(static_cast<const char*>(view), static_cast<size_t>(size.QuadPart), needle, ok);
+    UnmapViewOfFile(view);
+    return found;
 }
+#else
+inline bool file_contains(const native_string& path, std::string_view needle, const std::atomic<bool>& stop, bool& ok) {
+    return stream_contains(path, needle, stop, ok);
+}
+#endif
 
-// потокобезопасная очередь директорий
-class DirQueue { 
+// второй этап конвейера для --contains: совпавшие по имени файлы уходят в очередь,
+// отдельный пул потоков читает их и передаёт дальше только те, где нашлась подстрока.
+// Пулы обхода и чтения раздельные, чтобы медленное чтение не тормозило перечисление каталогов
+class ContentScanner {
 public:
-    void push(fs::path p) { // добавление директории в очередь
-        std::lock_guard<std::mutex> lk(mtx);
-        q.push(std::move(p));
-        cv.notify_one();
+    using OnHit = std::function<void(ResultSink::Buffer&, native_view, int)>;
+
+    static constexpr size_t max_queued = 1 << 16; // сверх этого обход ждёт, пока читатели разгребут очередь
+
+    ContentScanner(std::string needle, int num_threads, ResultSink& sink, const std::atomic<bool>& stop, OnHit on_hit)
+        : needle(std::move(needle)), sink(sink), stop(stop), on_hit(std::move(on_hit)) {
+        for (int i = 0; i < num_threads; ++i)
+            threads.emplace_back(&ContentScanner::run, this);
     }
 
-    bool pop_or_wait(fs::path& out, std::atomic<int>& pending_dirs, std::atomic<bool>& stop_flag) {
+    ~ContentScanner() { finish(); }
+
+    void submit(native_view path, int pattern) {
         std::unique_lock<std::mutex> lk(mtx);
-        cv.wait(lk, [&] { return !q.empty() || stop_flag.load() || pending_dirs.load() == 0; });
-        if (!q.empty()) {
-            out = std::move(q.front());
-            q.pop();
-            return true;
+        not_full.wait(lk, [&] { return queue.size() < max_queued || stop.load(); });
+        if (stop.load())
+            return;
+        queue.push_back({ native_string(path), pattern });
+        not_empty.notify_one();
+    }
+
+    // новых файлов больше не будет; ждёт, пока прочитаны уже поставленные
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            closed = true;
+        }
+        not_empty.notify_all();
+        for (auto& t : threads) {
+            if (t.joinable())
+                t.join();
         }
-        return false;
     }
 
-    void notify_all() { // пробуждение всех потоков
-        cv.notify_all();
+    // пробуждение ждущих при остановке по --limit
+    void wake() {
+        std::lock_guard<std::mutex> lk(mtx);
+        not_full.notify_all();
+        not_empty.notify_all();
     }
 
 private:
-    std::queue<fs::path> q;
+    struct Item {
+        native_string path;
+        int pattern;
+    };
+
+    void run() {
+        ResultSink::Buffer out(sink);
+        while (true) {
+            Item item;
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                not_empty.wait(lk, [&] { return !queue.empty() || closed || stop.load(); });
+                if (queue.empty() || stop.load())
+                    return;
+                item = std::move(queue.front());
+                queue.pop_front();
+                not_full.notify_one();
+            }
+            bool ok = true;
+            const bool found = file_contains(item.path, needle, stop, ok);
+            if (!ok)
+                LOG_WARN("Cannot read file: " + path_string(item.path));
+            else if (found)
+                on_hit(out, item.path, item.pattern);
+        }
+    }
+
+    const std::string needle;
+    ResultSink& sink;
+    const std::atomic<bool>& stop;
+    const OnHit on_hit;
+    std::deque<Item> queue;
+    bool closed = false;
     std::mutex mtx;
-    std::condition_variable cv;
+    std::condition_variable not_empty, not_full;
+    std::vector<std::thread> threads;
 };
 
-int main(int argc, char* argv[]) {
-    setlocale(LC_ALL, "ru");
+// резидентный режим (--serve): дерево стартового каталога строится один раз в памяти,
+// поддерживается в актуальном состоянии по ReadDirectoryChangesW и отвечает на запросы через
+// именованный канал. Обычный запуск сначала спрашивает такой сервер и обходит каталоги сам,
+// только если сервера нет или запрос ему не подходит
 
-    if (argc < 3) {
-        std::cout << "Использование:\n"
-            << "  " << argv[0] << " <start_path> <pattern> [num_threads]\n\n"
-            << "pattern: поддерживает '*' и '?' (например: *.txt, data_??.csv)\n"
-            << "Если не указать num_threads — будет использовано количество аппаратных потоков.\n";
-        return 1;
+// дерево каталога в памяти: узлы со ссылкой на родителя, именем и метаданными файла.
+// Узлы удалённых записей уходят в список свободных и переиспользуются. Поиск ребёнка по имени
+// линейный: изменения приходят по одному пути, а запросы идут обходом, а не поиском
+class TreeCache {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    // полное построение; root — абсолютный путь обслуживаемого каталога
+    void build(const native_string& root_path) {
+        nodes.clear();
+        kids.clear();
+        free_nodes.clear();
+        root = root_path;
+        nodes.emplace_back();
+        nodes[0].dir = true;
+        nodes[0].kids = new_kids();
+        fill(0, root);
+        LOG_INFO("Tree cache built: " + std::to_string(live) + " entries");
+    }
+
+    // изменения по путям относительно корня
+    void added(native_view rel) { // появилась запись или в это имя переименовали другую
+        uint32_t parent;
+        native_view name;
+        if (!split(rel, parent, name))
+            return;
+        if (parent == none) { // родителя ещё нет в дереве: он придёт вместе со всем своим поддеревом
+            added(rel.substr(0, rel.size() - name.size() - 1));
+            return;
+        }
+        const uint32_t old = child(parent, name);
+        if (old != none)
+            erase(old);
+        const native_string full = path_of(parent, name);
+        std::error_code ec;
+        const fs::directory_entry entry(fs::path(full), ec);
+        if (ec || !entry.exists(ec))
+            return;
+        const bool link = is_link(entry, ec);
+        if (!link && entry.is_directory(ec)) {
+            const uint32_t dir = insert(parent, name, FileMeta{}, true);
+            fill(dir, full);
+        }
+        else {
+            insert(parent, name, stl_meta(entry, need_size | need_time | need_attrs), false);
+        }
     }
 
-    fs::path start_path = argv[1];
-    std::string pattern = argv[2];
-    int num_threads = (argc >= 4) ? std::max(1, std::stoi(argv[3])) : std::max(1u, std::thread::hardware_concurrency());
+    void removed(native_view rel) { // запись исчезла или переименована из этого имени
+        const uint32_t n = find(rel);
+        if (n != none && n != 0)
+            erase(n);
+    }
 
-    log_file.open("filefinder.log", std::ios::out | std::ios::app);
-    if (!log_file.is_open()) {
-        std::cerr << "Не удалось открыть файл лога filefinder.log\n";
-        return 1;
+    void modified(native_view rel) { // изменились размер, время или атрибуты
+        const uint32_t n = find(rel);
+        if (n == none || nodes[n].dir)
+            return;
+        std::error_code ec;
+        const fs::directory_entry entry(fs::path(path_of(nodes[n].parent, nodes[n].name)), ec);
+        if (!ec)
+            nodes[n].meta = stl_meta(entry, need_size | need_time | need_attrs);
     }
 
-    log("\n=== FileFinder started at " + get_current_time() + " ===");
-    log("Start path: " + start_path.string());
-    log("Pattern: " + pattern);
-    log("Threads: " + std::to_string(num_threads));
+    // каталог по абсолютному пути внутри корня (как его строит canonical_root); none, если
+    // путь вне корня или такого каталога нет
+    uint32_t find_dir(native_view abs) const {
+        if (abs.size() < root.size() || !same_name(abs.substr(0, root.size()), root))
+            return none;
+        native_view rest = abs.substr(root.size());
+        if (!rest.empty() && !is_separator(rest.front()) && !is_separator(root.back()))
+            return none; // C:\data2 не лежит внутри C:\data
+        const uint32_t n = find(rest);
+        return n != none && nodes[n].dir ? n : none;
+    }
 
-    if (!fs::exists(start_path)) {
-        log("[error] Start path does not exist");
-        std::cerr << "Ошибка: стартовый путь не существует: " << start_path << "\n";
-        log_file.close();
-        return 1;
+    // файлы поддерева dir: on_match(путь относительно dir, номер шаблона); false из on_match
+    // останавливает обход
+    template <class OnMatch>
+    void query(uint32_t dir, const NativePatterns& patterns, const MetaFilter& filter, OnMatch&& on_match) const {
+        native_string rel;
+        walk(dir, rel, patterns, filter, on_match);
     }
 
-    DirQueue dirq;
-    std::atomic<int> pending_dirs{ 0 };
-    std::atomic<bool> stop_flag{ false };
+    const native_string& root_path() const { return root; }
 
-    dirq.push(start_path);
-    pending_dirs.fetch_add(1); // стартовую директорию добавляем в очередь
+private:
+    struct Node {
+        uint32_t parent = none;
+        uint32_t kids = none; // индекс списка детей в kids; у переиспользованного узла остаётся прежний
+        native_string name;
+        FileMeta meta;
+        bool dir = false;
+    };
 
-    auto worker = [&](int id) {
-        {
-            std::ostringstream oss;
-            oss << "Thread started. ID = " << std::this_thread::get_id();
-            log(oss.str());
+    static bool is_separator(native_char c) {
+#ifdef _WIN32
+        return c == L'\\' || c == L'/';
+#else
+        return c == '/';
+#endif
+    }
+
+    // имена на Windows сравниваются без учёта регистра, как их сравнивает NTFS
+    static bool same_name(native_view a, native_view b) {
+#ifdef _WIN32
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](wchar_t x, wchar_t y) { return fold_char(x) == fold_char(y); });
+#else
+        return a == b;
+#endif
+    }
+
+    uint32_t new_kids() {
+        kids.emplace_back();
+        return static_cast<uint32_t>(kids.size() - 1);
+    }
+
+    uint32_t child(uint32_t dir, native_view name) const {
+        for (uint32_t c : kids[nodes[dir].kids]) {
+            if (same_name(nodes[c].name, name))
+                return c;
         }
+        return none;
+    }
 
-        while (true) {
-            fs::path dir;
-            bool got = dirq.pop_or_wait(dir, pending_dirs, stop_flag);
-            if (!got) {
-                if (pending_dirs.load() == 0) break;
+    // узел по относительному пути; пустой путь — корень
+    uint32_t find(native_view rel) const {
+        uint32_t n = 0;
+        size_t pos = 0;
+        while (pos < rel.size() && n != none) {
+            if (is_separator(rel[pos])) {
+                ++pos;
                 continue;
             }
+            size_t end = pos;
+            while (end < rel.size() && !is_separator(rel[end]))
+                ++end;
+            n = nodes[n].dir ? child(n, rel.substr(pos, end - pos)) : none;
+            pos = end;
+        }
+        return n;
+    }
 
-            try {
-                for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied)) {
-                    if (entry.is_directory()) {
-                        pending_dirs.fetch_add(1);
-                        dirq.push(entry.path());
-                    }
-                    else if (entry.is_regular_file() || entry.is_symlink()) {
-                        std::string filename = entry.path().filename().string();
-                        if (matchWildcard(filename, pattern)) {
-                            any_file_found.store(true);  // пометка, что что-то нашли
+    // родитель и имя последнего компонента; parent == none, если родителя нет в дереве
+    bool split(native_view rel, uint32_t& parent, native_view& name) const {
+        while (!rel.empty() && is_separator(rel.back()))
+            rel.remove_suffix(1);
+        if (rel.empty())
+            return false;
+        size_t cut = rel.size();
+        while (cut > 0 && !is_separator(rel[cut - 1]))
+            --cut;
+        name = rel.substr(cut);
+        parent = find(rel.substr(0, cut));
+        if (parent != none && !nodes[parent].dir)
+            parent = none;
+        return true;
+    }
 
-                            std::string full_path = entry.path().string();
-                            std::string output = "Time: " + get_current_time() + " | Path: " + full_path;
+    native_string path_of(uint32_t dir, native_view name) const {
+        std::vector<uint32_t> chain;
+        for (uint32_t n = dir; n != 0; n = nodes[n].parent)
+            chain.push_back(n);
+        native_string out = root;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            append_component(out, nodes[*it].name);
+        append_component(out, name);
+        return out;
+    }
 
-                            std::cout << full_path << "\n";
-                            log(output);
-                        }
-                    }
+    uint32_t insert(uint32_t parent, native_view name, const FileMeta& meta, bool dir) {
+        uint32_t n;
+        if (!free_nodes.empty()) {
+            n = free_nodes.back();
+            free_nodes.pop_back();
+        }
+        else {
+            n = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+        Node& node = nodes[n];
+        node.parent = parent;
+        node.name.assign(name);
+        node.meta = meta;
+        node.dir = dir;
+        if (dir && node.kids == none)
+            node.kids = new_kids();
+        kids[nodes[parent].kids].push_back(n);
+        ++live;
+        return n;
+    }
+
+    void erase(uint32_t n) {
+        auto& siblings = kids[nodes[nodes[n].parent].kids];
+        siblings.erase(std::find(siblings.begin(), siblings.end(), n));
+        std::vector<uint32_t> stack{ n };
+        while (!stack.empty()) {
+            const uint32_t cur = stack.back();
+            stack.pop_back();
+            Node& node = nodes[cur];
+            if (node.dir) {
+                stack.insert(stack.end(), kids[node.kids].begin(), kids[node.kids].end());
+                kids[node.kids].clear();
+            }
+            node.name.clear();
+            node.name.shrink_to_fit();
+            free_nodes.push_back(cur);
+            --live;
+        }
+    }
+
+    // чтение поддерева с диска; ссылки на каталоги, как и в обходе по умолчанию, — просто записи
+    void fill(uint32_t top, const native_string& top_path) {
+        std::vector<std::pair<uint32_t, native_string>> stack{ { top, top_path } };
+        std::atomic<bool> never{ false };
+        while (!stack.empty()) {
+            const uint32_t dir = stack.back().first;
+            const native_string path = std::move(stack.back().second);
+            stack.pop_back();
+            auto on_dir = [&](native_view name) {
+                const uint32_t sub = insert(dir, name, FileMeta{}, true);
+                native_string sub_path = path;
+                append_component(sub_path, name);
+                stack.emplace_back(sub, std::move(sub_path));
+            };
+            auto on_file = [&](native_view name, auto&& meta) { insert(dir, name, meta(need_size | need_time | need_attrs), false); };
+            auto on_error = [&](const char* op, native_view where, const std::error_code& ec) {
+                LOG_DEBUG("Tree cache: " + path_string(where) + " - " + op + ": " + ec.message());
+            };
+#ifdef _WIN32
+            scan_nt(path, never, false, on_dir, on_file, on_error);
+#else
+            scan_stl(fs::path(path), never, false, on_dir, on_file, on_error);
+#endif
+        }
+    }
+
+    template <class OnMatch>
+    bool walk(uint32_t dir, native_string& rel, const NativePatterns& patterns, const MetaFilter& filter, OnMatch& on_match) const {
+        const size_t base = rel.size();
+        for (uint32_t c : kids[nodes[dir].kids]) {
+            const Node& node = nodes[c];
+            if (base != 0)
+                append_component(rel, node.name);
+            else
+                rel.assign(node.name);
+            bool go_on = true;
+            if (node.dir) {
+                go_on = walk(c, rel, patterns, filter, on_match);
+            }
+            else {
+                const int matched = patterns.match(node.name);
+                if (matched >= 0 && (!filter.active() || filter.match(node.meta)))
+                    go_on = on_match(native_view(rel), matched);
+            }
+            rel.resize(base);
+            if (!go_on)
+                return false;
+        }
+        return true;
+    }
+
+    native_string root;
+    std::vector<Node> nodes;                   // nodes[0] — корень
+    std::vector<std::vector<uint32_t>> kids;   // дети каталогов
+    std::vector<uint32_t> free_nodes;
+    size_t live = 0;
+};
+
+// корень в том виде, в каком его сравнивают сервер и клиент: абсолютный, без "." и ".." и без
+// завершающего разделителя (кроме корня тома)
+inline fs::path canonical_root(const fs::path& p) {
+    std::error_code ec;
+    fs::path r = fs::absolute(p, ec).lexically_normal();
+    if (!r.has_filename() && r.has_relative_path())
+        r = r.parent_path();
+    return r;
+}
+
+// запрос к серверу: текст UTF-8 построчно, "ключ значение"; ответ — строки
+// "<номер шаблона>\t<путь относительно root>", затем "end", либо одна строка "refuse <причина>",
+// и тогда клиент обходит каталоги сам
+struct ServerQuery {
+    std::string root;                  // абсолютный путь, UTF-8
+    std::vector<std::string> patterns; // UTF-8
+    long long limit = -1;
+    MetaFilter filter;
+
+    std::string encode() const {
+        std::ostringstream oss;
+        oss << "query\nroot " << root << "\n";
+        for (const std::string& p : patterns)
+            oss << "pattern " << p << "\n";
+        oss << "limit " << limit << "\n"
+            << "size " << filter.min_size << " " << filter.max_size << "\n"
+            << "time " << filter.newer << " " << filter.older << "\n"
+            << "attrs " << filter.require << " " << filter.reject << "\n"
+            << "end\n";
+        return oss.str();
+    }
+
+    bool decode(const std::string& text) {
+        std::istringstream in(text);
+        std::string line;
+        if (!std::getline(in, line) || line != "query")
+            return false;
+        while (std::getline(in, line)) {
+            const size_t sp = line.find(' ');
+            const std::string key = line.substr(0, sp);
+            const std::string value = sp == std::string::npos ? std::string() : line.substr(sp + 1);
+            std::istringstream v(value);
+            if (key == "end")
+                return !root.empty() && !patterns.empty();
+            if (key == "root")
+                root = value;
+            else if (key == "pattern")
+                patterns.push_back(value);
+            else if (key == "limit")
+                v >> limit;
+            else if (key == "size")
+                v >> filter.min_size >> filter.max_size;
+            else if (key == "time")
+                v >> filter.newer >> filter.older;
+            else if (key == "attrs")
+                v >> filter.require >> filter.reject;
+        }
+        return false;
+    }
+};
+
+// ответ сервера на один запрос; дерево читается под разделяемой блокировкой,
+// отправка идёт уже без неё, чтобы медленный клиент не задерживал применение изменений
+inline std::string answer_query(const TreeCache& cache, std::shared_mutex& lock, const std::string& request) {
+    ServerQuery q;
+    if (!q.decode(request))
+        return "refuse bad request\n";
+    NativePatterns patterns;
+    for (const std::string& p : q.patterns)
+        patterns.add(fs::u8path(p).native());
+
+    std::string out;
+    std::shared_lock<std::shared_mutex> lk(lock);
+    const uint32_t dir = cache.find_dir(fs::u8path(q.root).native());
+    if (dir == TreeCache::none)
+        return "refuse not covered\n";
+    long long left = q.limit;
+    cache.query(dir, patterns, q.filter, [&](native_view rel, int idx) {
+        out += std::to_string(idx);
+        out += '\t';
+        out += fs::path(rel).u8string();
+        out += '\n';
+        return left < 0 || --left > 0;
+    });
+    lk.unlock();
+    out += "end\n";
+    return out;
+}
+
+#ifdef _WIN32
+const wchar_t* const default_pipe = L"\\\\.\\pipe\\FileFinder";
+constexpr DWORD pipe_buffer = 1 << 16;
+
+// SID пользователя, от имени которого работает процесс
+inline bool process_user(HANDLE process, std::vector<unsigned char>& sid) {
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(process, TOKEN_QUERY, &token))
+        return false;
+    DWORD size = 0;
+    GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+    std::vector<unsigned char> info(size);
+    const bool ok = size != 0 && GetTokenInformation(token, TokenUser, info.data(), size, &size);
+    CloseHandle(token);
+    if (!ok)
+        return false;
+    const PSID user = reinterpret_cast<const TOKEN_USER*>(info.data())->User.Sid;
+    sid.assign(static_cast<const unsigned char*>(user), static_cast<const unsigned char*>(user) + GetLengthSid(user));
+    return true;
+}
+
+// канал с тем же именем может создать любой локальный процесс, поэтому ответ принимается,
+// только если сервер на другом конце запущен тем же пользователем, что и клиент
+inline bool trusted_server(HANDLE pipe) {
+    ULONG pid = 0;
+    if (!GetNamedPipeServerProcessId(pipe, &pid))
+        return false;
+    const HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process)
+        return false;
+    std::vector<unsigned char> server, self;
+    const bool ok = process_user(process, server) && process_user(GetCurrentProcess(), self);
+    CloseHandle(process);
+    return ok && EqualSid(server.data(), self.data());
+}
+
+// DACL канала сервера: полный доступ только у его пользователя, остальным подключиться нельзя
+struct PipeSecurity {
+    std::vector<unsigned char> sid;
+    std::vector<unsigned char> acl;
+    SECURITY_DESCRIPTOR sd{};
+    SECURITY_ATTRIBUTES sa{ sizeof(SECURITY_ATTRIBUTES), nullptr, FALSE };
+
+    PipeSecurity() = default;
+    PipeSecurity(const PipeSecurity&) = delete; // sa указывает на собственный sd
+    PipeSecurity& operator=(const PipeSecurity&) = delete;
+
+    bool init() {
+        if (!process_user(GetCurrentProcess(), sid))
+            return false;
+        acl.resize(sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) + sid.size());
+        PACL dacl = reinterpret_cast<PACL>(acl.data());
+        if (!InitializeAcl(dacl, static_cast<DWORD>(acl.size()), ACL_REVISION) ||
+            !AddAccessAllowedAce(dacl, ACL_REVISION, FILE_ALL_ACCESS, sid.data()) ||
+            !InitializeSecurityDescriptor(&sd, SECURITY_DESCRIPTOR_REVISION) || !SetSecurityDescriptorDacl(&sd, TRUE, dacl, FALSE))
+            return false;
+        sa.lpSecurityDescriptor = &sd;
+        return true;
+    }
+};
+
+// запись в канал целиком
+inline bool pipe_write(HANDLE pipe, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        DWORD n = 0;
+        const DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - done, 1 << 20));
+        if (!WriteFile(pipe, data.data() + done, chunk, &n, nullptr))
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// одно подключение: запрос до строки "end", ответ, отключение
+inline void serve_client(HANDLE pipe, const TreeCache& cache, std::shared_mutex& lock) {
+    std::string request;
+    char buf[4096];
+    while (request.find("\nend\n") == std::string::npos && request.size() < (1 << 20)) {
+        DWORD n = 0;
+        if (!ReadFile(pipe, buf, sizeof(buf), &n, nullptr) || n == 0)
+            break;
+        request.append(buf, n);
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    const std::string reply = answer_query(cache, lock, request);
+    LOG_INFO("Query answered in " + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count()) +
+        " us, " + std::to_string(reply.size()) + " bytes");
+    pipe_write(pipe, reply);
+    FlushFileBuffers(pipe);
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+}
+
+// поток наблюдения: ReadDirectoryChangesW по всему поддереву корня. Первый запрос уходит
+// до построения дерева, поэтому изменения, случившиеся во время построения, не теряются;
+// при переполнении буфера изменений дерево строится заново
+inline void watch_tree(HANDLE dir, HANDLE event, OVERLAPPED& ov, std::vector<DWORD>& buffer, TreeCache& cache, std::shared_mutex& lock) {
+    constexpr DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+    const DWORD size = static_cast<DWORD>(buffer.size() * sizeof(DWORD));
+    while (true) {
+        DWORD bytes = 0;
+        if (!GetOverlappedResult(dir, &ov, &bytes, TRUE)) {
+            const DWORD err = GetLastError();
+            if (err != ERROR_NOTIFY_ENUM_DIR) {
+                LOG_ERROR("ReadDirectoryChangesW failed: " + std::to_string(err) + ", tree cache is no longer updated");
+                return;
+            }
+            bytes = 0;
+        }
+        if (bytes == 0) { // изменений больше, чем поместилось в буфер
+            // новое дерево строится без блокировки, запросы тем временем отвечают по старому;
+            // cache меняет только этот поток, поэтому читать его здесь можно и без lock
+            LOG_WARN("Change buffer overflow, rebuilding tree cache");
+            TreeCache fresh;
+            fresh.build(cache.root_path());
+            std::unique_lock<std::shared_mutex> lk(lock);
+            std::swap(cache, fresh); // старое дерево освобождается уже после снятия блокировки
+        }
+        else {
+            std::unique_lock<std::shared_mutex> lk(lock);
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer.data());
+            while (true) {
+                const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+                const native_view rel(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                switch (info->Action) {
+                case FILE_ACTION_ADDED:
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                    cache.added(rel);
+                    break;
+                case FILE_ACTION_REMOVED:
+                case FILE_ACTION_RENAMED_OLD_NAME:
+                    cache.removed(rel);
+                    break;
+                default:
+                    cache.modified(rel);
+                    break;
                 }
+                if (info->NextEntryOffset == 0)
+                    break;
+                p += info->NextEntryOffset;
+            }
+        }
+        ov = OVERLAPPED{};
+        ov.hEvent = event;
+        if (!ReadDirectoryChangesW(dir, buffer.data(), size, TRUE, filter, nullptr, &ov, nullptr)) {
+            LOG_ERROR("ReadDirectoryChangesW failed: " + std::to_string(GetLastError()) + ", tree cache is no longer updated");
+            return;
+        }
+    }
+}
+
+// --serve: построение дерева, наблюдение за изменениями и приём запросов до завершения процесса
+inline int run_server(const fs::path& start_path, const std::wstring& pipe_name) {
+    const native_string root = canonical_root(start_path).native();
+    HandleGuard dir;
+    dir.h = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (dir.h == INVALID_HANDLE_VALUE) {
+        std::cerr << "Ошибка: не удалось открыть каталог для наблюдения (" << GetLastError() << ")\n";
+        return 1;
+    }
+    HandleGuard event;
+    event.h = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    std::vector<DWORD> buffer(pipe_buffer / sizeof(DWORD)); // 64 КиБ — предел ReadDirectoryChangesW для сетевых папок
+    OVERLAPPED ov{};
+    ov.hEvent = event.h;
+    if (!event.h || !ReadDirectoryChangesW(dir.h, buffer.data(), static_cast<DWORD>(buffer.size() * sizeof(DWORD)), TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE |
+            FILE_NOTIFY_CHANGE_ATTRIBUTES, nullptr, &ov, nullptr)) {
+        std::cerr << "Ошибка: ReadDirectoryChangesW недоступен для этого каталога (" << GetLastError() << ")\n";
+        return 1;
+    }
+
+    // дерево и его блокировка живут, пока жив последний поток клиента: потоки отсоединены
+    // и могут пережить выход из run_server, если канал перестал создаваться
+    struct Shared {
+        TreeCache cache;
+        std::shared_mutex lock;
+    };
+    const auto shared = std::make_shared<Shared>();
+    TreeCache& cache = shared->cache;
+    std::shared_mutex& lock = shared->lock;
+    const auto t0 = std::chrono::steady_clock::now();
+    cache.build(root);
+    std::cout << "Дерево построено за " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()
+        << " мс, ожидание запросов на " << fs::path(pipe_name).string() << "\n";
+    std::thread watcher(watch_tree, dir.h, event.h, std::ref(ov), std::ref(buffer), std::ref(cache), std::ref(lock));
+
+    // каждое подключение — свой экземпляр канала и свой поток; удалённые клиенты не принимаются.
+    // Первый экземпляр создаётся с FILE_FLAG_FIRST_PIPE_INSTANCE: если имя уже занято кем-то
+    // другим, сервер не запускается, а не становится одним из экземпляров чужого канала
+    PipeSecurity security;
+    if (!security.init()) {
+        std::cerr << "Ошибка: не удалось подготовить права доступа к каналу (" << GetLastError() << ")\n";
+        CancelIoEx(dir.h, &ov);
+        watcher.join();
+        return 1;
+    }
+    bool first = true;
+    while (true) {
+        const HANDLE pipe = CreateNamedPipeW(pipe_name.c_str(), PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
+            pipe_buffer, pipe_buffer, 0, &security.sa);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            const DWORD err = GetLastError();
+            std::cerr << "Ошибка: не удалось создать канал " << fs::path(pipe_name).string() << " (" << err << ")"
+                << (first && err == ERROR_ACCESS_DENIED ? ", возможно, сервер уже запущен" : "") << "\n";
+            break;
+        }
+        first = false;
+        if (!ConnectNamedPipe(pipe, nullptr) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            CloseHandle(pipe);
+            continue;
+        }
+        std::thread([pipe, shared] { serve_client(pipe, shared->cache, shared->lock); }).detach();
+    }
+    CancelIoEx(dir.h, &ov);
+    watcher.join();
+    return 1;
+}
+
+// запрос к серверу; false — сервера нет или он отказался, и тогда обход идёт как обычно.
+// Результаты приходят путями относительно root и передаются в on_result(путь, номер шаблона)
+template <class OnResult>
+bool query_server(const std::wstring& pipe_name, const ServerQuery& q, OnResult&& on_result) {
+    HandleGuard pipe;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        // SECURITY_IDENTIFICATION: сервер не сможет действовать от имени клиента
+        pipe.h = CreateFileW(pipe_name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+            SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, nullptr);
+        if (pipe.h != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(pipe_name.c_str(), 200))
+            break;
+    }
+    if (pipe.h == INVALID_HANDLE_VALUE)
+        return false;
+    if (!trusted_server(pipe.h)) {
+        LOG_WARN("Pipe server " + fs::path(pipe_name).string() + " runs as another user, ignoring it");
+        return false;
+    }
+    if (!pipe_write(pipe.h, q.encode()))
+        return false;
+
+    std::string pending;
+    char buf[1 << 16];
+    bool first_line = true;
+    while (true) {
+        DWORD n = 0;
+        if (!ReadFile(pipe.h, buf, sizeof(buf), &n, nullptr) || n == 0) {
+            if (first_line)
+                return false;
+            LOG_ERROR("Connection to server lost, results may be incomplete");
+            return true;
+        }
+        pending.append(buf, n);
+        size_t start = 0;
+        for (size_t eol; (eol = pending.find('\n', start)) != std::string::npos; start = eol + 1) {
+            const std::string_view line(pending.data() + start, eol - start);
+            if (first_line && line.rfind("refuse", 0) == 0) {
+                LOG_INFO("Server refused query: " + std::string(line));
+                return false;
+            }
+            first_line = false;
+            if (line == "end")
+                return true;
+            const size_t tab = line.find('\t');
+            if (tab == std::string_view::npos)
+                continue;
+            on_result(fs::u8path(line.substr(tab + 1)).native(), std::atoi(std::string(line.substr(0, tab)).c_str()));
+        }
+        pending.erase(0, start);
+    }
+}
+
+// поиск через запущенный сервер; false — обход нужен как обычно. Пути ответа приклеиваются
+// к start_path в том виде, в каком его задал пользователь, как и у остальных способов поиска
+template <class OnMatch>
+bool search_server(const std::wstring& pipe_name, const fs::path& start_path, const std::vector<std::string>& pattern_list,
+    const MetaFilter& filter, long long limit, const std::atomic<bool>& stop, ResultSink& sink, OnMatch&& on_match) {
+    ServerQuery q;
+    q.root = canonical_root(start_path).u8string();
+    for (const std::string& p : pattern_list)
+        q.patterns.push_back(fs::path(p).u8string());
+    q.limit = limit;
+    q.filter = filter;
+
+    ResultSink::Buffer out(sink);
+    std::wstring full;
+    const bool answered = query_server(pipe_name, q, [&](const std::wstring& rel, int idx) {
+        if (stop.load(std::memory_order_relaxed))
+            return;
+        full.assign(start_path.native());
+        append_component(full, rel);
+        on_match(out, full, idx);
+    });
+    if (answered)
+        LOG_INFO("Mode: server " + fs::path(pipe_name).string());
+    return answered;
+}
+#endif
+
+// коды возврата; «не найдено» отличается от успеха только с --exists
+constexpr int exit_found = 0;
+constexpr int exit_not_found = 1;
+constexpr int exit_error = 2; // неверные параметры или поиск не удалось выполнить
+
+int main(int argc, char* argv[]) {
+    const auto program_start = std::chrono::high_resolution_clock::now(); // точка отсчёта для --progress и отчёта
+    setlocale(LC_ALL, "ru");
+    const trace::Registration trace_provider;
+
+    // позиционные аргументы и ключи вида --name=value можно перемешивать
+    std::vector<std::string> args;
+    Backend backend = Backend::stl;
+    Traversal order = Traversal::dfs;
+    size_t max_queue = 1 << 20;   // --max-queue: сверх этого подкаталоги обходятся сразу, без очереди
+    int io_depth = 64;            // --io-depth: запросов в полёте у --backend=iocp
+    bool use_mft = false;
+    std::string build_index_file; // --build-index: построить/обновить индекс и выйти
+    std::string index_file;       // --index: искать по готовому индексу
+    std::vector<std::string> extra_patterns; // --pattern: дополнительные шаблоны
+    std::string log_path = "filefinder.log";
+    LogLevel log_level = LogLevel::info;
+    long long limit = -1;         // --first/--limit: сколько совпадений вывести, -1 — все
+    bool exists_only = false;     // --exists: только код возврата
+    MetaFilter filter;            // --min-size, --max-size, --newer, --older, --hidden, --readonly, --system
+    Pruner prune;                 // --exclude, --max-depth, --ignore-file
+    LinkPolicy links = LinkPolicy::root; // --follow-links
+    std::vector<std::string> exclude_list;
+    std::string bench_report;     // --bench-report: итоги прогона в JSON для FileFinderBench
+    bool print_stats = false;     // --stats: сводка счётчиков обхода в stderr при выходе
+    int progress_sec = 0;         // --progress: строка прогресса в stderr раз в столько секунд, 0 — выключена
+    std::string contains;         // --contains: подстрока, которая должна быть в содержимом файла
+    int grep_threads = 0;         // --grep-threads: потоков чтения содержимого, 0 — по числу аппаратных
+    bool serve = false;           // --serve: держать дерево в памяти и отвечать на запросы
+    bool no_server = false;       // --no-server: не спрашивать сервер, обходить самому
+    std::string pipe_name;        // --pipe: имя канала сервера
+    OutputFormat format = OutputFormat::text; // --format, -0, --jsonl
+    SortKey sort_key = SortKey::none; // --sort: вывод упорядочивается после обхода
+    bool unique = false;          // --unique: с --sort один путь на файл
+    std::vector<std::string> extra_roots; // --root: ещё стартовые пути
+    int device_threads = 0;       // --device-threads: предел потоков на устройство, 0 — по типу устройства
+    std::string listing_cache;    // --listing-cache: файл кэша списков каталогов между запусками
+    bool bad_option = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--backend=stl") {
+            backend = Backend::stl;
+        }
+        else if (arg == "--backend=win32" || arg == "--backend=nt" || arg == "--backend=iocp") {
+#ifdef _WIN32
+            backend = (arg == "--backend=nt") ? Backend::nt : (arg == "--backend=iocp") ? Backend::iocp : Backend::win32;
+#else
+            std::cerr << "Ошибка: " << arg << " доступен только в Windows\n";
+            return exit_error;
+#endif
+        }
+        else if (arg.rfind("--order=", 0) == 0) {
+            static const char* const names[] = { "dfs", "bfs", "hybrid" };
+            const std::string value = arg.substr(8);
+            auto it = std::find(std::begin(names), std::end(names), value);
+            if (it == std::end(names)) {
+                std::cerr << "Неизвестный порядок обхода: " << value << "\n";
+                bad_option = true;
             }
-            catch (const fs::filesystem_error& e) {
-                log(std::string("[warn] Access denied or error in directory: ") + dir.string() + " - " + e.what());
+            else {
+                order = static_cast<Traversal>(it - std::begin(names));
             }
-            catch (const std::exception& e) {
-                log(std::string("[error] Unexpected exception in directory: ") + dir.string() + " - " + e.what());
+        }
+        else if (arg.rfind("--max-queue=", 0) == 0) {
+            const std::string value = arg.substr(12);
+            char* end = nullptr;
+            const long long n = std::strtoll(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || n < 0) {
+                std::cerr << "Ошибка: --max-queue ожидает неотрицательное число\n";
+                bad_option = true;
             }
-            catch (...) {
-                log(std::string("[error] Unknown exception in directory: ") + dir.string());
+            else {
+                max_queue = static_cast<size_t>(n);
             }
+        }
+        else if (arg.rfind("--io-depth=", 0) == 0) {
+            const std::string value = arg.substr(11);
+            char* end = nullptr;
+            const long n = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || n < 1) {
+                std::cerr << "Ошибка: --io-depth ожидает положительное число\n";
+                bad_option = true;
+            }
+            else {
+                io_depth = static_cast<int>(std::min(n, 4096L));
+            }
+        }
+        else if (arg == "--mft") {
+#ifdef _WIN32
+            use_mft = true;
+#else
+            std::cerr << "Ошибка: --mft доступен только в Windows\n";
+            return exit_error;
+#endif
+        }
+        else if (arg.rfind("--build-index=", 0) == 0 || arg.rfind("--index=", 0) == 0) {
+#ifdef _WIN32
+            (arg[2] == 'b' ? build_index_file : index_file) = arg.substr(arg.find('=') + 1);
+#else
+            std::cerr << "Ошибка: " << arg.substr(0, arg.find('=')) << " доступен только в Windows\n";
+            return exit_error;
+#endif
+        }
+        else if (arg.rfind("--pattern=", 0) == 0) {
+            extra_patterns.push_back(arg.substr(10));
+        }
+        else if (arg.rfind("--log-file=", 0) == 0) {
+            log_path = arg.substr(11);
+        }
+        else if (arg.rfind("--log-level=", 0) == 0) {
+            static const char* const names[] = { "off", "error", "warn", "info", "debug" };
+            const std::string value = arg.substr(12);
+            auto it = std::find(std::begin(names), std::end(names), value);
+            if (it == std::end(names)) {
+                std::cerr << "Неизвестный уровень лога: " << value << "\n";
+                bad_option = true;
+            }
+            else {
+                log_level = static_cast<LogLevel>(it - std::begin(names));
+            }
+        }
+        else if (arg == "--first") {
+            limit = 1;
+        }
+        else if (arg == "--exists") {
+            exists_only = true;
+            limit = 1;
+        }
+        else if (arg == "--limit" || arg.rfind("--limit=", 0) == 0) {
+            const std::string value = (arg == "--limit") ? (i + 1 < argc ? argv[++i] : "") : arg.substr(8);
+            char* end = nullptr;
+            limit = std::strtoll(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || limit < 1) {
+                std::cerr << "Ошибка: --limit ожидает положительное число\n";
+                bad_option = true;
+            }
+        }
+        else if (arg.rfind("--min-size=", 0) == 0 || arg.rfind("--max-size=", 0) == 0) {
+            const bool is_min = arg[2] == 'm' && arg[3] == 'i';
+            if (!MetaFilter::parse_size(arg.substr(11), is_min ? filter.min_size : filter.max_size)) {
+                std::cerr << "Ошибка: неверный размер в " << arg << " (пример: 1500, 64K, 10M, 1G)\n";
+                bad_option = true;
+            }
+        }
+        else if (arg.rfind("--newer=", 0) == 0 || arg.rfind("--older=", 0) == 0) {
+            if (!MetaFilter::parse_time(arg.substr(8), arg[2] == 'n' ? filter.newer : filter.older)) {
+                std::cerr << "Ошибка: неверная дата в " << arg << " (пример: 2026-10-01 или \"2026-10-01 12:30\")\n";
+                bad_option = true;
+            }
+        }
+        else if (arg == "--hidden" || arg == "--no-hidden") {
+            (arg[2] == 'h' ? filter.require : filter.reject) |= attr_hidden;
+        }
+        else if (arg == "--readonly") {
+            filter.require |= attr_readonly;
+        }
+        else if (arg == "--system") {
+            filter.require |= attr_system;
+        }
+        else if (arg.rfind("--exclude=", 0) == 0) {
+            exclude_list.push_back(arg.substr(10));
+            prune.exclude.add(fs::path(exclude_list.back()).native());
+            prune.has_exclude = true;
+        }
+        else if (arg.rfind("--max-depth=", 0) == 0) {
+            const std::string value = arg.substr(12);
+            char* end = nullptr;
+            const long long n = std::strtoll(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || n < 0) {
+                std::cerr << "Ошибка: --max-depth ожидает неотрицательное число\n";
+                bad_option = true;
+            }
+            else {
+                prune.max_depth = static_cast<uint32_t>(std::min<long long>(n, UINT32_MAX - 1));
+            }
+        }
+        else if (arg.rfind("--follow-links=", 0) == 0) {
+            static const char* const names[] = { "never", "root", "always" };
+            const std::string value = arg.substr(15);
+            auto it = std::find(std::begin(names), std::end(names), value);
+            if (it == std::end(names)) {
+                std::cerr << "Неизвестный режим ссылок: " << value << "\n";
+                bad_option = true;
+            }
+            else {
+                links = static_cast<LinkPolicy>(it - std::begin(names));
+            }
+        }
+        else if (arg.rfind("--ignore-file=", 0) == 0) {
+            prune.ignore_name = fs::path(arg.substr(14)).native();
+        }
+        else if (arg.rfind("--bench-report=", 0) == 0) {
+            bench_report = arg.substr(15);
+        }
+        else if (arg == "--stats") {
+            print_stats = true;
+        }
+        else if (arg == "--progress") {
+            progress_sec = 1;
+        }
+        else if (arg.rfind("--progress=", 0) == 0) {
+            progress_sec = std::atoi(arg.c_str() + 11);
+            if (progress_sec <= 0) {
+                std::cerr << "Ошибка: --progress ожидает положительное число секунд\n";
+                bad_option = true;
+            }
+        }
+        else if (arg.rfind("--contains=", 0) == 0) {
+            contains = arg.substr(11);
+            if (contains.empty()) {
+                std::cerr << "Ошибка: --contains ожидает непустую строку\n";
+                bad_option = true;
+            }
+        }
+        else if (arg.rfind("--grep-threads=", 0) == 0) {
+            const std::string value = arg.substr(15);
+            char* end = nullptr;
+            const long n = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || n < 1) {
+                std::cerr << "Ошибка: --grep-threads ожидает положительное число\n";
+                bad_option = true;
+            }
+            else {
+                grep_threads = static_cast<int>(std::min(n, 256L));
+            }
+        }
+        else if (arg == "--serve") {
+#ifdef _WIN32
+            serve = true;
+#else
+            std::cerr << "Ошибка: --serve доступен только в Windows\n";
+            return exit_error;
+#endif
+        }
+        else if (arg == "-0" || arg == "--jsonl") {
+            format = (arg == "-0") ? OutputFormat::nul : OutputFormat::jsonl;
+        }
+        else if (arg.rfind("--format=", 0) == 0) {
+            static const char* const names[] = { "text", "nul", "jsonl", "binary" };
+            const std::string value = arg.substr(9);
+            auto it = std::find(std::begin(names), std::end(names), value);
+            if (it == std::end(names)) {
+                std::cerr << "Неизвестный формат вывода: " << value << "\n";
+                bad_option = true;
+            }
+            else {
+                format = static_cast<OutputFormat>(it - std::begin(names));
+            }
+        }
+        else if (arg.rfind("--sort=", 0) == 0) {
+            static const char* const names[] = { "none", "path", "size", "mtime" };
+            const std::string value = arg.substr(7);
+            auto it = std::find(std::begin(names), std::end(names), value);
+            if (it == std::end(names)) {
+                std::cerr << "Неизвестный ключ сортировки: " << value << "\n";
+                bad_option = true;
+            }
+            else {
+                sort_key = static_cast<SortKey>(it - std::begin(names));
+            }
+        }
+        else if (arg == "--unique") {
+            unique = true;
+        }
+        else if (arg.rfind("--root=", 0) == 0) {
+            extra_roots.push_back(arg.substr(7));
+        }
+        else if (arg.rfind("--device-threads=", 0) == 0) {
+            const std::string value = arg.substr(17);
+            char* end = nullptr;
+            const long n = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || n < 1) {
+                std::cerr << "Ошибка: --device-threads ожидает положительное число\n";
+                bad_option = true;
+            }
+            else {
+                device_threads = static_cast<int>(std::min(n, 4096L));
+            }
+        }
+        else if (arg.rfind("--listing-cache=", 0) == 0) {
+            listing_cache = arg.substr(16);
+            if (listing_cache.empty()) {
+                std::cerr << "Ошибка: --listing-cache ожидает имя файла\n";
+                bad_option = true;
+            }
+        }
+        else if (arg == "--no-server") {
+            no_server = true;
+        }
+        else if (arg.rfind("--pipe=", 0) == 0) {
+            pipe_name = arg.substr(7);
+        }
+        else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Неизвестный параметр: " << arg << "\n";
+            bad_option = true;
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size() < (build_index_file.empty() && !serve ? 2u : 1u) || bad_option) {
+        std::cout << "Использование:\n"
+            << "  " << argv[0] << " <start_path> <pattern> [num_threads] [параметры]\n"
+            << "  " << argv[0] << " <start_path> --build-index=<файл>\n"
+            << "  " << argv[0] << " <start_path> --serve [--pipe=<имя>]\n\n"
+            << "pattern: поддерживает '*' и '?' (например: *.txt, data_??.csv);\n"
+            << "         @<файл> — список шаблонов, по одному в строке\n"
+            << "Если не указать num_threads — будет использовано количество аппаратных потоков;\n"
+            << "auto — число потоков подбирается по ходу обхода по измеренной скорости перечисления.\n\n"
+            << "Параметры:\n"
+            << "  --backend=stl|win32|nt|iocp\n"
+            << "                          способ перечисления каталогов (по умолчанию stl); iocp — асинхронные\n"
+            << "                          запросы через порт завершения, для сетевых папок\n"
+            << "  --io-depth=N            запросов в полёте у iocp независимо от числа потоков (по умолчанию 64)\n"
+            << "  --order=dfs|bfs|hybrid  порядок обхода каталогов (по умолчанию dfs)\n"
+            << "  --max-queue=N           предел очереди каталогов; сверх него подкаталоги обходятся сразу (по умолчанию 1048576, 0 — без предела)\n"
+            << "  --mft                   читать MFT тома NTFS вместо обхода каталогов (нужны права администратора)\n"
+            << "  --build-index=<файл>    сохранить индекс тома в файл; повторный запуск догружает изменения из журнала USN\n"
+            << "  --index=<файл>          искать по сохранённому индексу вместо обхода каталогов\n"
+            << "                          (с --mft и --index файл с несколькими жёсткими ссылками выводится по одному пути)\n"
+            << "  --pattern=<шаблон>      дополнительный шаблон, можно указывать несколько раз;\n"
+            << "                          при нескольких шаблонах после пути через табуляцию выводится совпавший\n"
+            << "  --log-file=<файл>       файл лога (по умолчанию filefinder.log)\n"
+            << "  --log-level=<уровень>   off|error|warn|info|debug (по умолчанию info)\n"
+            << "  --first                 остановиться на первом совпадении\n"
+            << "  --limit N               остановиться после N совпадений\n"
+            << "  --exists                ничего не выводить, ответ — только код возврата\n"
+            << "  --min-size=N, --max-size=N\n"
+            << "                          размер файла в байтах, можно с K, M, G, T (например --min-size=1G)\n"
+            << "  --newer=<дата>, --older=<дата>\n"
+            << "                          время изменения не раньше / раньше даты YYYY-MM-DD[ HH:MM[:SS]]\n"
+            << "  --hidden, --no-hidden   только скрытые / только не скрытые файлы\n"
+            << "  --readonly, --system    только файлы с атрибутом «только чтение» / «системный»\n"
+            << "                          фильтры берут данные из записей каталога, без лишних обращений к файлам\n"
+            << "  --exclude=<шаблон>      не заходить в каталоги и не выводить файлы с таким именем\n"
+            << "                          (например --exclude=node_modules --exclude=.git), можно несколько раз\n"
+            << "  --max-depth=N           не глубже N уровней подкаталогов (0 — только сам стартовый каталог)\n"
+            << "  --ignore-file=<имя>     читать правила из файлов с этим именем в каталогах (например .gitignore)\n"
+            << "  --follow-links=never|root|always\n"
+            << "                          переход по ссылкам на каталоги и junction-точкам: никогда, только по стартовому\n"
+            << "                          пути (по умолчанию) или всегда — тогда каждый каталог обходится один раз;\n"
+            << "                          при never стартовый путь-ссылка отклоняется с ошибкой\n"
+            << "  --contains=<текст>      выводить только файлы, в содержимом которых есть текст (точное совпадение байтов)\n"
+            << "  --bench-report=<файл>   записать итоги прогона (каталоги, записи, задержки) в JSON для FileFinderBench\n"
+            << "  --stats                 при выходе вывести в stderr счётчики обхода по потокам, задержки и глубину очереди\n"
+            << "  --progress[=N]          строка прогресса в stderr раз в N секунд (по умолчанию 1)\n"
+            << "  --grep-threads=N        потоков чтения содержимого для --contains (по умолчанию по числу ядер)\n"
+            << "  --format=text|nul|jsonl|binary\n"
+            << "                          формат вывода: text — строки в кодировке консоли (по умолчанию); nul (-0) —\n"
+            << "                          пути UTF-8 через '\\0'; jsonl (--jsonl) — JSON на строку с path, size, mtime\n"
+            << "                          (секунды Unix) и pattern; binary — записи: длина пути uint32 LE, номер\n"
+            << "                          шаблона uint16 LE, путь UTF-8\n"
+            << "  --sort=path|size|mtime  вывести найденное по порядку: каждый поток сортирует своё, в конце отрезки\n"
+            << "                          сливаются; --limit тогда берёт первые N по этому порядку\n"
+            << "  --unique                с --sort выводить файл один раз, даже если он найден по нескольким путям\n"
+            << "                          (ссылки при --follow-links=always, жёсткие ссылки)\n"
+            << "  --root=<путь>           ещё один стартовый путь, можно несколько раз (например --root=D:\\ --root=\\\\srv\\share);\n"
+            << "                          пути делятся по физическим дискам и серверам, у каждой группы свой предел потоков\n"
+            << "  --device-threads=N      предел потоков на диск или сервер; по умолчанию 2 для дисков с головками,\n"
+            << "                          для остальных без предела, но так, чтобы одно устройство не заняло все потоки\n"
+            << "  --serve                 держать дерево стартового каталога в памяти, следить за изменениями\n"
+            << "                          и отвечать на запросы; обычный запуск внутри этого каталога спросит сервер\n"
+            << "  --pipe=<имя>            имя канала сервера (по умолчанию \\\\.\\pipe\\FileFinder)\n"
+            << "  --no-server             не обращаться к серверу, обходить каталоги самому\n"
+            << "  --listing-cache=<файл>  хранить списки каталогов между запусками: каталог с прежним временем изменения\n"
+            << "                          не перечисляется, шаблоны сверяются с сохранёнными именами\n"
+            << "\nКоды возврата: 0 — поиск выполнен (с --exists — файл найден), 1 — с --exists файл не найден,\n"
+            << "2 — ошибка: неверные параметры, недоступный стартовый путь, индекс или лог\n"
+            << "\nВ Windows программа пишет события ETW провайдера FileFinder: wpr -start FileFinder.wprp, затем wpr -stop <файл.etl>\n";
+        return exit_error;
+    }
 
-            int remaining = pending_dirs.fetch_sub(1) - 1; // уменьшаем количество директорий на 1, если закончили с текущей
-            if (remaining == 0) {
-                dirq.notify_all();
+    fs::path start_path = args[0];
+    std::vector<fs::path> roots{ start_path }; // стартовый путь и все --root
+    roots.insert(roots.end(), extra_roots.begin(), extra_roots.end());
+    std::string pattern = (args.size() >= 2) ? args[1] : std::string();
+    const int hw_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    // num_threads=auto: потоков создаётся с запасом, сколько из них работает, решает ThreadController
+    const bool auto_threads = args.size() >= 3 && args[2] == "auto";
+    int num_threads = auto_threads ? std::clamp(hw_threads * 4, 4, 128)
+        : (args.size() >= 3) ? std::max(1, std::stoi(args[2])) : hw_threads;
+
+    // список шаблонов: позиционный (или @файл) и все --pattern
+    std::vector<std::string> pattern_list;
+    if (pattern.size() > 1 && pattern[0] == '@') {
+        std::ifstream in(pattern.substr(1));
+        if (!in) {
+            std::cerr << "Ошибка: не удалось открыть список шаблонов " << pattern.substr(1) << "\n";
+            return exit_error;
+        }
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                pattern_list.push_back(line);
+        }
+    }
+    else if (!pattern.empty()) {
+        pattern_list.push_back(pattern);
+    }
+    pattern_list.insert(pattern_list.end(), extra_patterns.begin(), extra_patterns.end());
+    if (pattern_list.empty() && build_index_file.empty() && !serve) {
+        std::cerr << "Ошибка: не задано ни одного шаблона\n";
+        return exit_error;
+    }
+
+    NativePatterns patterns; // шаблоны в кодировке имён файловой системы, разобранные один раз
+    for (const std::string& p : pattern_list)
+        patterns.add(fs::path(p).native());
+
+    if (!logger.open(log_path, log_level)) {
+        std::cerr << "Не удалось открыть файл лога " << log_path << "\n";
+        return exit_error;
+    }
+
+    LOG_INFO("\n=== FileFinder started at " + get_current_time() + " ===");
+    for (const fs::path& r : roots)
+        LOG_INFO("Start path: " + r.string());
+    for (const std::string& p : pattern_list)
+        LOG_INFO("Pattern: " + p);
+    LOG_INFO(auto_threads ? "Threads: auto, up to " + std::to_string(num_threads) : "Threads: " + std::to_string(num_threads));
+    LOG_INFO(std::string("Backend: ") + backend_name(backend) +
+        (backend == Backend::iocp ? ", io depth " + std::to_string(io_depth) : std::string()));
+    LOG_INFO(std::string("Order: ") + traversal_name(order) + ", max queue " + std::to_string(max_queue));
+    LOG_INFO(std::string("Follow links: ") + (links == LinkPolicy::never ? "never" : links == LinkPolicy::root ? "root" : "always"));
+    if (limit > 0)
+        LOG_INFO(std::string(exists_only ? "Mode: exists" : "Limit: ") + (exists_only ? "" : std::to_string(limit)));
+    if (!contains.empty())
+        LOG_INFO("Contains: " + contains);
+    for (const std::string& e : exclude_list)
+        LOG_INFO("Exclude: " + e);
+    if (prune.max_depth != UINT32_MAX)
+        LOG_INFO("Max depth: " + std::to_string(prune.max_depth));
+    if (!prune.ignore_name.empty())
+        LOG_INFO("Ignore file: " + path_string(prune.ignore_name));
+    if (filter.active()) {
+        std::ostringstream oss;
+        oss << "Filter:";
+        if (filter.min_size != 0) oss << " size >= " << filter.min_size;
+        if (filter.max_size != UINT64_MAX) oss << " size <= " << filter.max_size;
+        if (filter.newer != INT64_MIN) oss << " mtime >= " << filter.newer;
+        if (filter.older != INT64_MAX) oss << " mtime < " << filter.older;
+        if (filter.require) oss << " attrs & 0x" << std::hex << filter.require << std::dec;
+        if (filter.reject) oss << " no attrs 0x" << std::hex << filter.reject << std::dec;
+        LOG_INFO(oss.str());
+    }
+    if (use_mft)
+        LOG_INFO("Mode: mft");
+    if (!index_file.empty())
+        LOG_INFO("Mode: index " + index_file);
+    if (no_server)
+        LOG_INFO("Mode: no server");
+    if (!listing_cache.empty())
+        LOG_INFO("Listing cache: " + listing_cache);
+    if (format != OutputFormat::text)
+        LOG_INFO(std::string("Output: ") + (format == OutputFormat::nul ? "nul" : format == OutputFormat::jsonl ? "jsonl" : "binary"));
+    if (sort_key != SortKey::none)
+        LOG_INFO(std::string("Sort: ") + (sort_key == SortKey::path ? "path" : sort_key == SortKey::size ? "size" : "mtime") + (unique ? ", unique" : ""));
+
+    if ((use_mft || !index_file.empty()) && (filter.needs() & (need_size | need_time))) {
+        std::cerr << "Ошибка: фильтры по размеру и времени недоступны с --mft и --index, в индексе есть только атрибуты\n";
+        logger.close();
+        return exit_error;
+    }
+    if (unique && sort_key == SortKey::none) {
+        std::cerr << "Ошибка: --unique работает только вместе с --sort\n";
+        logger.close();
+        return exit_error;
+    }
+    if ((use_mft || !index_file.empty() || !build_index_file.empty() || serve) && roots.size() > 1) {
+        std::cerr << "Ошибка: --mft, --index, --build-index и --serve работают с одним стартовым путём, без --root\n";
+        logger.close();
+        return exit_error;
+    }
+    if ((use_mft || !index_file.empty()) && prune.active()) {
+        std::cerr << "Ошибка: --exclude, --max-depth и --ignore-file работают только при обходе каталогов\n";
+        logger.close();
+        return exit_error;
+    }
+    if (backend == Backend::iocp && !prune.ignore_name.empty())
+        LOG_WARN("--ignore-file is not supported by the iocp backend and is ignored there");
+    if (!listing_cache.empty() && (use_mft || !index_file.empty() || (backend == Backend::iocp && roots.size() == 1)))
+        LOG_WARN("--listing-cache is used only by the threaded directory walk and is ignored here");
+
+    for (const fs::path& r : roots) {
+        std::error_code start_ec;
+        if (!fs::exists(r, start_ec)) {
+            // нет доступа, слишком длинный путь и прочие сбои — не то же самое, что отсутствие пути
+            if (start_ec) {
+                LOG_ERROR("Cannot check start path " + r.string() + ": " + start_ec.message());
+                std::cerr << "Ошибка: не удалось проверить стартовый путь " << r << ": " << start_ec.message() << "\n";
             }
+            else {
+                LOG_ERROR("Start path does not exist: " + r.string());
+                std::cerr << "Ошибка: стартовый путь не существует: " << r << "\n";
+            }
+            logger.close();
+            return exit_error;
         }
-        {
-            std::ostringstream oss;
-            oss << "Thread finished. ID = " << std::this_thread::get_id();
-            log(oss.str());
+        // та же проверка, что и в обходе: в MSVC ссылкой считается и junction-точка
+        if (links == LinkPolicy::never && is_link(fs::directory_entry(r, start_ec), start_ec)) {
+            LOG_ERROR("Start path is a link and --follow-links=never does not follow links: " + r.string());
+            std::cerr << "Ошибка: стартовый путь — ссылка, а --follow-links=never по ссылкам не переходит: " << r << "\n";
+            logger.close();
+            return exit_error;
         }
-        };
+    }
 
-    // запуск потоков
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-    for (int i = 0; i < num_threads; ++i) {
-        threads.emplace_back(worker, i);
+#ifdef _WIN32
+    if (!build_index_file.empty()) {
+        LOG_INFO("Mode: build index " + build_index_file);
+        bool ok = build_index(start_path, build_index_file);
+        LOG_INFO("=== FileFinder finished ===");
+        logger.close();
+        return ok ? exit_found : exit_error;
+    }
+    const std::wstring server_pipe = pipe_name.empty() ? std::wstring(default_pipe) : fs::path(pipe_name).native();
+    if (serve) {
+        LOG_INFO("Mode: serve " + path_string(server_pipe));
+        const int rc = run_server(start_path, server_pipe);
+        LOG_INFO("=== FileFinder finished ===");
+        logger.close();
+        return rc == 0 ? exit_found : exit_error;
     }
+#endif
+
+    // вывод найденного файла
+    ResultSink sink(pattern_list, format);
+    if (sort_key != SortKey::none && !exists_only) {
+        // квота относится к упорядоченному выводу: обход идёт до конца и её не видит
+        sink.sort_by(sort_key, limit, unique, hw_threads);
+        limit = -1;
+    }
+    std::cout.flush();
+    sink.start();
+
+    std::atomic<bool> stop_flag{ false };
+    std::atomic<long long> match_count{ 0 };
+    const bool count_matches = !bench_report.empty() || print_stats || progress_sec > 0;
+
+    // обход потоками; сам движок ничего не выводит, найденное приходит пачками в report_match ниже
+    SearchOptions walk;
+    walk.roots = roots;
+    walk.patterns = patterns;
+    walk.filter = filter;
+    walk.prune = prune;
+    walk.links = links;
+    walk.backend = backend;
+    walk.order = order;
+    walk.threads = num_threads;
+    walk.auto_threads = auto_threads;
+    walk.max_queue = max_queue;
+    walk.device_threads = device_threads;
+    walk.timed = !bench_report.empty() || print_stats;
+    // квоту по именам движок считает сам, общим для потоков счётчиком, и останавливает обход, как только
+    // совпадений набралось достаточно; какие из них выводить, точно решает emit_match. С --contains часть
+    // совпадений по имени отсеет проверка содержимого, поэтому квоту тогда считает только emit_match
+    const long long name_limit = contains.empty() ? limit : -1;
+    walk.limit = name_limit;
+    walk.stop = &stop_flag;
+    // кэш списков читается до обхода и сохраняется после него, если что-то перечислялось заново
+    ListingCache listings(links == LinkPolicy::always);
+    if (!listing_cache.empty()) {
+        const auto t0 = std::chrono::steady_clock::now();
+        const ListingCache::ReadStatus status = listings.read(listing_cache);
+        if (status == ListingCache::ReadStatus::loaded)
+            LOG_INFO("Listing cache: " + std::to_string(listings.size()) + " directories, loaded in " +
+                std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()) + " ms");
+        else if (status == ListingCache::ReadStatus::other_mode)
+            LOG_INFO("Listing cache was built with another --follow-links mode, starting over");
+        else if (status == ListingCache::ReadStatus::corrupt)
+            LOG_WARN("Listing cache is unreadable, starting over: " + listing_cache);
+        walk.listings = &listings;
+    }
+    FinderEngine engine(std::move(walk));
+
+    // обход закончен или остановлен: будим и спящих в очереди, и ждущих своей очереди в режиме auto
+    ContentScanner* content_stage = nullptr; // создаётся ниже, после emit_match
+    std::atomic<bool> any_file_found{ false };  // найден ли хотя бы один файл
+    auto wake_all = [&] {
+        engine.cancel();
+        if (content_stage)
+            content_stage->wake();
+    };
 
-    // ожидание завершения
-    for (auto& t : threads) {
-        if (t.joinable()) t.join();
+    // окончательное совпадение: по имени, а при --contains — ещё и по содержимому
+    auto emit_match = [&](ResultSink::Buffer& out, native_view full, int pattern_idx) {
+        if (limit > 0) {
+            // квоту разбирают атомарно: совпадения сверх неё, найденные другими потоками до остановки, отбрасываются
+            const long long n = match_count.fetch_add(1, std::memory_order_relaxed);
+            if (n >= limit)
+                return;
+            if (n + 1 == limit) {
+                stop_flag.store(true);
+                wake_all();
+            }
+        }
+        else if (count_matches) {
+            match_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!any_file_found.load(std::memory_order_relaxed))
+            any_file_found.store(true);  // пометка, что что-то нашли
+        trace::match(full, pattern_idx);
+        if (!exists_only) {
+            if (sink.wants_meta()) { // размер и время дочитываются только для найденного, а не для каждой записи
+                // файл могли удалить или закрыть к нему доступ после совпадения: тогда он выводится
+                // без размера и времени, а не с нулями вместо них
+                std::error_code ec;
+                const fs::directory_entry entry(fs::path(full), ec);
+                if (ec) {
+                    LOG_DEBUG("Cannot read metadata of " + path_string(full) + ": " + ec.message());
+                    out.add(full, pattern_idx);
+                }
+                else {
+                    const FileMeta meta = stl_meta(entry, need_size | need_time);
+                    out.add(full, pattern_idx, &meta);
+                }
+            }
+            else {
+                out.add(full, pattern_idx);
+            }
+        }
+    };
+
+    std::unique_ptr<ContentScanner> content;
+    if (!contains.empty())
+        content = std::make_unique<ContentScanner>(contains, grep_threads > 0 ? grep_threads : hw_threads, sink, stop_flag, emit_match);
+    content_stage = content.get();
+
+    // совпадение по имени: сразу в вывод или в очередь на проверку содержимого
+    auto report_match = [&](ResultSink::Buffer& out, native_view full, int pattern_idx) {
+        if (content)
+            content->submit(full, pattern_idx);
+        else
+            emit_match(out, full, pattern_idx);
+    };
+
+    // пачка потока обхода id: совпадения уходят дальше по одному, пути копирует уже буфер вывода
+    std::vector<std::unique_ptr<ResultSink::Buffer>> buffers(engine.threads());
+    auto on_batch = [&](int id, MatchBatch& batch) {
+        if (!buffers[id])
+            buffers[id] = std::make_unique<ResultSink::Buffer>(sink);
+        for (const FoundFile f : batch)
+            report_match(*buffers[id], f.path, f.pattern);
+    };
+    using stat_clock = std::chrono::steady_clock;
+
+    // --stats и --progress: замеры глубины очереди и строка прогресса из отдельного потока,
+    // который только читает счётчики и ничем не мешает обходу
+    LatencyHistogram queue_depth; // пишет только поток замеров
+    std::mutex monitor_mtx;
+    std::condition_variable monitor_cv;
+    bool monitor_done = false;
+    bool progress_shown = false;
+    auto run_monitor = [&] {
+        constexpr auto sample_interval = std::chrono::milliseconds(100);
+        const auto progress_interval = std::chrono::seconds(progress_sec);
+        auto next_progress = stat_clock::now() + progress_interval;
+        std::unique_lock<std::mutex> lk(monitor_mtx);
+        while (!monitor_cv.wait_for(lk, sample_interval, [&] { return monitor_done; })) {
+            queue_depth.record(engine.queued());
+            if (progress_sec == 0 || stat_clock::now() < next_progress)
+                continue;
+            next_progress += progress_interval;
+            uint64_t dirs = 0, entries = 0;
+            for (const WalkCounters& c : engine.counters()) {
+                dirs += c.dirs.get();
+                entries += c.entries.get();
+            }
+            const double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - program_start).count();
+            char line[160];
+            std::snprintf(line, sizeof(line), "\r[%.0f с] каталогов: %llu, записей: %llu, найдено: %lld, в очереди: %zu   ",
+                secs, static_cast<unsigned long long>(dirs), static_cast<unsigned long long>(entries), match_count.load(), engine.queued());
+            std::cerr << line << std::flush;
+            progress_shown = true;
+        }
+    };
+
+    bool searched = false;
+#ifdef _WIN32
+    // сервер знает только имена, метаданные и ссылки в режиме root; отсечение каталогов и остальные
+    // способы поиска он не повторяет, поэтому с ними запрос не посылается
+    const bool ask_server = !no_server && index_file.empty() && !use_mft && !prune.active() && links == LinkPolicy::root && roots.size() == 1;
+    // сервер, как и движок, применяет квоту к совпадениям по имени, поэтому с --contains отдаёт всё
+    if (ask_server && search_server(server_pipe, start_path, pattern_list, filter, name_limit, stop_flag, sink, report_match)) {
+        searched = true;
+    }
+    else if (!index_file.empty()) {
+        if (!search_index_file(index_file, start_path, patterns, filter, auto_threads ? hw_threads : num_threads, stop_flag, sink, report_match)) {
+            logger.close();
+            return exit_error;
+        }
+        searched = true;
+    }
+    else if (use_mft) {
+        searched = search_mft(start_path, patterns, filter, auto_threads ? hw_threads : num_threads, stop_flag, sink, report_match);
+    }
+    else if (backend == Backend::iocp && roots.size() > 1) {
+        LOG_WARN("The iocp backend handles a single start path; several roots are walked by threads with the nt scanner");
+    }
+    else if (backend == Backend::iocp) {
+        // при переходе по всем ссылкам iocp отсекает циклы так же, как обход потоками
+        std::unique_ptr<VisitedDirs> visited;
+        if (links == LinkPolicy::always)
+            visited = std::make_unique<VisitedDirs>();
+        searched = search_iocp(start_path, patterns, filter, prune, links, visited.get(), auto_threads ? hw_threads : num_threads, io_depth, stop_flag, sink, report_match);
+    }
+#endif
+
+    if (!searched) {
+        std::thread monitor;
+        if (print_stats || progress_sec > 0)
+            monitor = std::thread(run_monitor);
+        // буфер отдаёт остаток (с --sort — и сортирует свой отрезок) в потоке, который его заполнял
+        engine.run(on_batch, [&](int id) { buffers[id].reset(); });
+        if (monitor.joinable()) {
+            {
+                std::lock_guard<std::mutex> lk(monitor_mtx);
+                monitor_done = true;
+            }
+            monitor_cv.notify_one();
+            monitor.join();
+        }
+        if (!listing_cache.empty() && listings.changed()) {
+            if (std::error_code ec = listings.save(listing_cache))
+                LOG_WARN("Cannot write listing cache: " + listing_cache + " - " + ec.message());
+            else
+                LOG_INFO("Listing cache saved: " + std::to_string(listings.size()) + " directories");
+        }
+    }
+    if (content)
+        content->finish(); // дочитываются файлы, поставленные обходом
+
+    if (progress_shown)
+        std::cerr << "\n";
+    if (!bench_report.empty()) {
+        const WalkTotals total(engine.counters());
+        const auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - program_start);
+        std::ofstream report(bench_report, std::ios::trunc);
+        report << "{\"dirs\": " << total.dirs << ", \"entries\": " << total.entries
+            << ", \"matches\": " << (limit > 0 ? std::min(match_count.load(), limit) : match_count.load()) << ", \"wall_us\": " << wall.count()
+            << ", \"dir_p50_ns\": " << total.latency.percentile(0.50) << ", \"dir_p99_ns\": " << total.latency.percentile(0.99)
+            << ", \"dir_max_ns\": " << total.latency.max() << "}\n";
+        if (!report)
+            LOG_WARN("Cannot write bench report: " + bench_report);
+    }
+    sink.finish(); // всё найденное выведено до итоговых сообщений
+    if (print_stats) {
+        if (searched)
+            std::cerr << "--stats: счётчики ведутся только при обходе каталогов потоками (не для --mft, --index и iocp)\n";
+        else
+            print_walk_stats(engine.counters(), queue_depth, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - program_start).count());
     }
 
-    if (!any_file_found.load()) { // если не нашли ни одного файла по шаблону
-        std::cout << "Искомый файл не найден\n";
-        log("[info] No files matched the pattern");
+    const bool found = any_file_found.load();
+    if (!found) { // если не нашли ни одного файла по шаблону
+        if (!exists_only) // в машиночитаемых форматах stdout остаётся пустым
+            (format == OutputFormat::text ? std::cout : std::cerr) << "Искомый файл не найден\n";
+        LOG_INFO("No files matched the pattern");
     }
 
-    log("=== FileFinder finished ===");
-    log_file.close();
+    LOG_INFO("=== FileFinder finished ===");
+    logger.close();
 
-    return 0;
+    return (exists_only && !found) ? exit_not_found : exit_found;
 }
\ No newline at end of file
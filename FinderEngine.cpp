@@ -0,0 +1,664 @@
+﻿#include "FinderEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "ListingCache.h"
+#include "Log.h"
+#include "Trace.h"
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+namespace trace {
+// {ee0c84fd-7a48-5d43-dec1-97fc4d6b25f0}
+TRACELOGGING_DEFINE_PROVIDER(provider, "FileFinder",
+    (0xee0c84fd, 0x7a48, 0x5d43, 0xde, 0xc1, 0x97, 0xfc, 0x4d, 0x6b, 0x25, 0xf0));
+}
+#endif
+
+using DirQueue = BasicDirQueue<const DirNode*>;
+
+// подбор числа потоков в режиме auto: все потоки создаются сразу, но работают только первые
+// active; раз в interval контроллер сравнивает скорость обхода (каталогов в секунду) с лучшей
+// замеченной и двигает active вверх, пока это даёт прирост, затем пробует меньше и
+// останавливается на лучшем значении, периодически перепроверяя его
+class ThreadController {
+public:
+    static constexpr auto interval = std::chrono::milliseconds(250);
+
+    ThreadController(int max_workers, int initial)
+        : slots(max_workers), max_workers(max_workers), active_count(std::clamp(initial, 1, max_workers)) {}
+
+    int active() const { return active_count.load(std::memory_order_relaxed); }
+
+    // время обхода одного каталога потоком id
+    void record(int id, std::chrono::steady_clock::duration latency) {
+        Slot& slot = slots[id];
+        slot.dirs.store(slot.dirs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot.nanos.store(slot.nanos.load(std::memory_order_relaxed) +
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()), std::memory_order_relaxed);
+    }
+
+    // ожидание, пока поток id входит в активный набор; false — обход закончен
+    bool wait_turn(int id) {
+        if (id < active())
+            return !finished.load();
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [&] { return id < active() || finished.load(); });
+        return !finished.load();
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lk(mtx);
+        finished.store(true);
+        cv.notify_all();
+    }
+
+    // цикл контроллера; queue_size — сколько каталогов ждёт в очереди
+    template <class QueueSize>
+    void run(QueueSize&& queue_size) {
+        uint64_t last_dirs = 0, last_nanos = 0;
+        auto last_time = std::chrono::steady_clock::now();
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                if (cv.wait_for(lk, interval, [&] { return finished.load(); }))
+                    break;
+            }
+            uint64_t dirs = 0, nanos = 0;
+            for (const Slot& slot : slots) {
+                dirs += slot.dirs.load(std::memory_order_relaxed);
+                nanos += slot.nanos.load(std::memory_order_relaxed);
+            }
+            const auto now = std::chrono::steady_clock::now();
+            const uint64_t d_dirs = dirs - last_dirs;
+            const double seconds = std::chrono::duration<double>(now - last_time).count();
+            const double latency_ms = d_dirs ? (nanos - last_nanos) / 1e6 / d_dirs : 0.0;
+            last_dirs = dirs;
+            last_nanos = nanos;
+            last_time = now;
+
+            // замер годится, только если потокам хватало работы: иначе скорость ограничена деревом, а не числом потоков
+            if (d_dirs < 16 || queue_size() < static_cast<size_t>(active()))
+                continue;
+            step(d_dirs / seconds, latency_ms);
+        }
+        LOG_INFO("Auto threads: finished with " + std::to_string(active()) + " active" +
+            (best_n > 0 ? ", best " + std::to_string(best_n) + " at " + std::to_string(static_cast<long long>(best_rate)) + " dirs/s" : ""));
+    }
+
+private:
+    enum class Phase { grow, shrink, hold };
+
+    void step(double rate, double latency_ms) {
+        const int n = active();
+        const bool better = rate > best_rate * 1.05; // прирост меньше 5% считается шумом
+        if (better) {
+            best_rate = rate;
+            best_n = n;
+        }
+
+        int next = n;
+        switch (phase) {
+        case Phase::grow:
+            if (better && n < max_workers) {
+                next = std::min(max_workers, n + std::max(1, n / 4));
+            }
+            else if (better) {
+                phase = Phase::hold;
+            }
+            else {
+                phase = Phase::shrink;
+                next = std::max(1, best_n - std::max(1, best_n / 4));
+            }
+            break;
+        case Phase::shrink:
+            if (better && n > 1) {
+                next = std::max(1, n - std::max(1, n / 4));
+            }
+            else {
+                phase = Phase::hold;
+                next = best_n;
+            }
+            break;
+        case Phase::hold:
+            // дерево меняется по ходу обхода: время от времени скорость меряется заново
+            if (++held >= 20) {
+                held = 0;
+                best_rate = rate;
+                best_n = n;
+                phase = Phase::grow;
+                next = std::min(max_workers, n + std::max(1, n / 4));
+            }
+            break;
+        }
+
+        if (next != n) {
+            std::ostringstream oss;
+            oss << "Auto threads: " << n << " -> " << next << " (" << static_cast<long long>(rate) << " dirs/s, "
+                << std::fixed << std::setprecision(2) << latency_ms << " ms per directory)";
+            LOG_INFO(oss.str());
+            std::lock_guard<std::mutex> lk(mtx);
+            active_count.store(next);
+            cv.notify_all();
+        }
+    }
+
+    struct alignas(64) Slot { // пишет только свой поток, читает контроллер
+        std::atomic<uint64_t> dirs{ 0 };
+        std::atomic<uint64_t> nanos{ 0 };
+    };
+
+    std::vector<Slot> slots;
+    const int max_workers;
+    std::atomic<int> active_count;
+    std::atomic<bool> finished{ false };
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    // состояние только потока контроллера
+    Phase phase = Phase::grow;
+    double best_rate = 0.0;
+    int best_n = 0;
+    int held = 0;
+};
+
+struct FinderEngine::State {
+    SearchOptions opt;
+    int num_threads = 1;
+    int hw_threads = 1;
+    std::atomic<bool> own_stop{ false };
+    std::atomic<bool>* stop = nullptr;  // opt.stop или own_stop
+    std::vector<unsigned> root_group;   // группа устройства для каждого стартового пути
+    std::unique_ptr<DirQueue> dirq;
+    std::unique_ptr<ThreadController> controller;
+    std::vector<WalkCounters> walk_counters;
+    std::atomic<int> pending_dirs{ 0 };
+    std::atomic<long long> matched{ 0 }; // совпадений всех потоков, для SearchOptions::limit
+    bool started = false;
+
+    // обход закончен или остановлен: будим и спящих в очереди, и ждущих своей очереди в режиме auto
+    void wake_all() {
+        dirq->notify_all();
+        if (controller)
+            controller->finish();
+    }
+
+    void walk(const BatchCallback& on_batch, const ThreadDoneCallback& on_done);
+};
+
+FinderEngine::FinderEngine(SearchOptions options) : st(std::make_unique<State>()) {
+    State& s = *st;
+    s.opt = std::move(options);
+    s.stop = s.opt.stop ? s.opt.stop : &s.own_stop;
+    s.hw_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    s.num_threads = s.opt.threads > 0 ? s.opt.threads : s.hw_threads;
+    if (s.opt.batch == 0)
+        s.opt.batch = 1;
+
+    // стартовые пути по устройствам: у каждого диска или сервера свой предел потоков в общей очереди,
+    // чтобы медленная сетевая папка не заняла все потоки, а диск с головками не дёргали со всех сторон.
+    // С одним стартовым путём и без device_threads пределов нет
+    s.root_group.assign(s.opt.roots.size(), 0);
+    std::vector<DeviceInfo> devices;
+    std::vector<int> budgets;
+    if (s.opt.roots.size() > 1 || s.opt.device_threads > 0) {
+        for (size_t i = 0; i < s.opt.roots.size(); ++i) {
+            DeviceInfo d = device_of(s.opt.roots[i]);
+            auto it = std::find_if(devices.begin(), devices.end(), [&](const DeviceInfo& x) { return x.key == d.key; });
+            s.root_group[i] = static_cast<unsigned>(it - devices.begin());
+            if (it == devices.end())
+                devices.push_back(std::move(d));
+        }
+        const int fair_cap = std::max(1, s.num_threads - static_cast<int>(devices.size() - 1)); // остальным группам по потоку
+        for (const DeviceInfo& d : devices) {
+            const int b = s.opt.device_threads > 0 ? s.opt.device_threads : std::min(d.rotational ? 2 : s.num_threads, fair_cap);
+            budgets.push_back(b);
+            LOG_INFO("Device: " + d.key + (d.rotational ? ", rotational" : "") + (d.remote ? ", remote" : "") +
+                ", up to " + std::to_string(b) + " threads");
+        }
+        for (size_t i = 0; i < s.opt.roots.size(); ++i)
+            LOG_DEBUG("Start path " + path_string(s.opt.roots[i].native()) + " -> " + devices[s.root_group[i]].key);
+    }
+    s.dirq = std::make_unique<DirQueue>(s.num_threads, s.opt.order, std::move(budgets));
+    if (s.opt.auto_threads)
+        s.controller = std::make_unique<ThreadController>(s.num_threads, s.hw_threads);
+    s.walk_counters = std::vector<WalkCounters>(s.num_threads);
+}
+
+FinderEngine::~FinderEngine() = default;
+
+void FinderEngine::run(const BatchCallback& on_batch, const ThreadDoneCallback& on_done) {
+    if (st->started) {
+        LOG_ERROR("FinderEngine::run called twice");
+        return;
+    }
+    st->started = true;
+    st->walk(on_batch, on_done);
+}
+
+void FinderEngine::cancel() {
+    st->stop->store(true);
+    st->wake_all();
+}
+
+bool FinderEngine::cancelled() const { return st->stop->load(); }
+int FinderEngine::threads() const { return st->num_threads; }
+size_t FinderEngine::queued() const { return st->dirq->size(); }
+const std::vector<WalkCounters>& FinderEngine::counters() const { return st->walk_counters; }
+const SearchOptions& FinderEngine::options() const { return st->opt; }
+
+void FinderEngine::State::walk(const BatchCallback& on_batch, const ThreadDoneCallback& on_done) {
+    const NativePatterns& patterns = opt.patterns;
+    const MetaFilter& filter = opt.filter;
+    const Pruner& prune = opt.prune;
+    const size_t max_queue = opt.max_queue;
+    const Backend backend = opt.backend;
+    std::atomic<bool>& stop_flag = *stop;
+    DirQueue& queue = *dirq;
+    const bool prune_on = prune.active();
+    const unsigned filter_needs = filter.needs();
+    const bool filter_on = filter_needs != 0;
+    (void)backend; // вне Windows способ перечисления один
+
+    // арены и правила живут до конца обхода: узел, созданный одним потоком, может обрабатывать другой
+    std::vector<PathArena> arenas(num_threads);
+    std::vector<std::deque<IgnoreRules>> ignore_rules(num_threads);
+    // при переходе по всем ссылкам каждый каталог перед обходом сверяется с уже обойдёнными:
+    // это отсекает циклы и повторный обход общих поддеревьев ценой открытия каталога
+    const bool follow_links = opt.links == LinkPolicy::always;
+    std::unique_ptr<VisitedDirs> visited;
+    if (follow_links)
+        visited = std::make_unique<VisitedDirs>();
+    // замеры времени нужны только контроллеру и тем, кто читает WalkCounters; без них обход часов не читает
+    const bool timed = controller || opt.timed;
+    const bool tracing_queue = trace::enabled(trace::kw_queue); // сеанс ETW проверяется один раз при запуске
+    using stat_clock = std::chrono::steady_clock;
+    auto elapsed_ns = [](stat_clock::time_point since) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stat_clock::now() - since).count());
+    };
+    if (opt.roots.empty())
+        return;
+    ListingCache* const listings = opt.listings;
+    if (listings)
+        listings->prepare(num_threads);
+    for (size_t i = 0; i < opt.roots.size(); ++i) { // стартовые директории добавляем в очередь, каждую в группу её устройства
+        pending_dirs.fetch_add(1);
+        queue.push(0, arenas[0].make(nullptr, opt.roots[i].native()), root_group[i]);
+    }
+
+    // глубина вложенного обхода, после которой подкаталоги всё равно уходят в очередь
+    constexpr size_t max_inline_depth = 64;
+
+    auto worker = [&](int id) {
+        MatchBatch out;
+        // пачка очищается и тогда, когда on_batch бросил исключение: иначе её совпадения
+        // ушли бы потребителю повторно со следующей пачкой
+        auto flush = [&] {
+            struct ClearGuard {
+                MatchBatch& batch;
+                ~ClearGuard() { batch.clear(); }
+            } clear_guard{ out };
+            on_batch(id, out);
+        };
+        auto report_match = [&](native_view full, int pattern_idx) {
+            out.add(full, pattern_idx);
+            // квота общая для потоков: на её последнем совпадении обход останавливается сразу, а не когда
+            // пачки наберут все потоки; неполные пачки остальных уходят потребителю при выходе из потоков
+            if (opt.limit > 0 && matched.fetch_add(1, std::memory_order_relaxed) + 1 == opt.limit) {
+                stop_flag.store(true);
+                wake_all();
+                flush();
+            }
+            else if (out.size() >= opt.batch) {
+                flush();
+            }
+        };
+        PathArena& arena = arenas[id];
+        // состояние каждого уровня вложенного обхода: путь каталога и, когда читаются файлы
+        // игнорирования, отложенные до конца перечисления подкаталоги и совпадения
+        struct Level {
+            native_string path;
+            std::vector<DirNode*> dirs;
+            struct Held {
+                native_string full;
+                size_t name_off;
+                int pattern;
+            };
+            std::vector<Held> files;
+            ListingCache::Listing listing; // снимок для кэша списков, пока каталог перечисляется
+        };
+        std::deque<Level> levels;
+        std::deque<IgnoreRules>& rules_store = ignore_rules[id];
+        native_string full;
+        WalkCounters& stats = walk_counters[id];
+        uint64_t nested_ns = 0; // время вложенного обхода, которое не относится к перечислению текущего каталога
+        if (logger.enabled(LogLevel::info)) {
+            std::ostringstream oss;
+            oss << "Thread started. ID = " << std::this_thread::get_id();
+            LOG_INFO(oss.str());
+        }
+        trace::thread_start(id);
+
+        // обход одного каталога; когда очередь упёрлась в max_queue, подкаталог
+        // обходится тут же рекурсивно, и его соседи ждут в открытом дескрипторе, а не в памяти
+        auto scan_dir = [&](auto& self, const DirNode* dir, size_t level) -> void {
+            if (levels.size() <= level)
+                levels.emplace_back();
+            Level& lv = levels[level];
+            native_string& dir_path = lv.path;
+            dir->path(dir_path);
+            LOG_DEBUG("Directory: " + path_string(dir_path));
+            if (visited) {
+                DirIdentity ident;
+                if (dir_identity(dir_path, ident) && !visited->insert(ident)) {
+                    ++stats.revisits;
+                    LOG_DEBUG("Already visited: " + path_string(dir_path));
+                    return;
+                }
+            }
+            ++stats.dirs;
+            trace::dir_begin(id, dir_path, dir->depth);
+            const uint64_t entries_before = stats.entries.get();
+
+            // файл игнорирования может встретиться в любом месте перечисления, поэтому при
+            // --ignore-file подкаталоги и совпадения придерживаются, пока каталог не дочитан
+            const bool hold = !prune.ignore_name.empty();
+            bool has_ignore_file = false;
+            lv.dirs.clear();
+            lv.files.clear();
+
+            // каталог не менялся с прошлого запуска — имена берутся из кэша, и он не перечисляется;
+            // иначе перечисленное запоминается, если обошлось без ошибок и остановки
+            const ListingCache::Listing* cached = nullptr;
+            bool recording = false;
+            if (listings) {
+                lv.listing.clear();
+                if (ListingCache::dir_stamp(dir_path, lv.listing.stamp)) {
+                    cached = listings->find(dir_path, lv.listing.stamp);
+                    recording = !cached;
+                }
+            }
+
+            auto enqueue = [&](const DirNode* sub) {
+                if (max_queue != 0 && queue.size() >= max_queue && level < max_inline_depth) {
+                    if (timed) {
+                        const uint64_t outer = nested_ns;
+                        const auto t0 = stat_clock::now();
+                        self(self, sub, level + 1);
+                        nested_ns = outer + elapsed_ns(t0);
+                    }
+                    else {
+                        self(self, sub, level + 1);
+                    }
+                    return;
+                }
+                pending_dirs.fetch_add(1);
+                queue.push(id, sub);
+            };
+            auto on_dir = [&](native_view name) {
+                ++stats.entries;
+                if (recording)
+                    lv.listing.add(name, true);
+                if (prune_on && prune.skip_dir(dir, name))
+                    return;
+                DirNode* sub = arena.make(dir, name);
+                if (hold)
+                    lv.dirs.push_back(sub);
+                else
+                    enqueue(sub);
+            };
+            auto on_file = [&](native_view filename, auto&& meta) {
+                ++stats.entries;
+                if (recording)
+                    lv.listing.add(filename, false);
+                if (hold && filename == prune.ignore_name)
+                    has_ignore_file = true;
+                const int matched = patterns.match(filename);
+                if (matched >= 0 && (!prune_on || !prune.skip_file(dir, filename)) &&
+                    (!filter_on || filter.match(meta(filter_needs)))) {
+                    ++stats.matches;
+                    full.assign(dir_path);
+                    append_component(full, filename);
+                    if (hold)
+                        lv.files.push_back({ full, full.size() - filename.size(), matched });
+                    else
+                        report_match(full, matched);
+                }
+            };
+
+            // ошибки приходят кодами, без исключений: отказ в доступе на деревьях с ACL бывает
+            // десятками тысяч, и в лог он идёт только на уровне debug
+            auto on_error = [&](const char* op, native_view where, const std::error_code& ec) {
+                const WalkError kind = classify_error(ec);
+                stats.error(kind);
+                recording = false; // список мог остаться неполным
+                trace::fs_error(where, ec, op);
+                if (kind == WalkError::access_denied)
+                    LOG_DEBUG("Access denied: " + path_string(where));
+                else
+                    LOG_WARN("Error in directory: " + path_string(where) + " - " + op + ": " + ec.message());
+            };
+
+            // записи из кэша: метаданные файла читаются, только если имя совпало и их просит фильтр
+            auto replay = [&](const ListingCache::Listing& l) {
+                for (const ListingCache::Entry& e : l.entries) {
+                    if (stop_flag.load(std::memory_order_relaxed))
+                        return;
+                    const native_view name = l.name(e);
+                    if (e.dir) {
+                        on_dir(name);
+                        continue;
+                    }
+                    on_file(name, [&](unsigned need) {
+                        native_string path(dir_path);
+                        append_component(path, name);
+                        std::error_code ec;
+                        const fs::directory_entry entry(fs::path(path), ec);
+                        return stl_meta(entry, need);
+                    });
+                }
+            };
+
+            const uint64_t nested_before = nested_ns;
+            const auto scan_start = timed ? stat_clock::now() : stat_clock::time_point();
+            try {
+                if (cached) {
+                    ++stats.cached;
+                    replay(*cached);
+                }
+#ifdef _WIN32
+                else if (backend == Backend::nt || backend == Backend::iocp) // iocp сюда попадает, только если порт недоступен
+                    scan_nt(dir_path, stop_flag, follow_links, on_dir, on_file, on_error);
+                else if (backend == Backend::win32)
+                    scan_win32(dir_path, stop_flag, follow_links, on_dir, on_file, on_error);
+#endif
+                else
+                    scan_stl(fs::path(dir_path), stop_flag, follow_links, on_dir, on_file, on_error);
+                if (recording && !stop_flag.load())
+                    listings->store(id, dir_path, std::move(lv.listing));
+            }
+            catch (const std::exception& e) { // нехватка памяти или исключение из on_batch
+                stats.error(WalkError::exception);
+                LOG_ERROR(std::string("Unexpected exception in directory: ") + path_string(dir_path) + " - " + e.what());
+            }
+            catch (...) {
+                stats.error(WalkError::exception);
+                LOG_ERROR(std::string("Unknown exception in directory: ") + path_string(dir_path));
+            }
+            if (timed)
+                stats.scan_ns.add(elapsed_ns(scan_start) - (nested_ns - nested_before));
+            trace::dir_end(id, stats.entries.get() - entries_before); // вместе с записями вложенного обхода
+            if (!hold)
+                return;
+
+            const IgnoreRules* rules = dir->rules;
+            if (has_ignore_file) {
+                IgnoreRules& r = rules_store.emplace_back();
+                r.parent = dir->rules;
+                r.owner = dir;
+                full.assign(dir_path);
+                append_component(full, prune.ignore_name);
+                if (r.load(fs::path(full))) {
+                    rules = &r;
+                    LOG_DEBUG("Ignore file: " + path_string(full));
+                }
+            }
+            // унаследованные правила уже проверены в on_dir/on_file, здесь — только новые из этого каталога
+            for (const Level::Held& f : lv.files) {
+                if (rules == dir->rules || !IgnoreRules::ignored(rules, dir, native_view(f.full).substr(f.name_off), false))
+                    report_match(f.full, f.pattern);
+            }
+            for (DirNode* sub : lv.dirs) { // deque не перемещает уровни при росте, lv остаётся действительным
+                if (rules != dir->rules && IgnoreRules::ignored(rules, dir, sub->name(), true))
+                    continue;
+                sub->rules = rules;
+                enqueue(sub);
+            }
+        };
+
+        while (true) {
+            if (controller && !controller->wait_turn(id))
+                break;
+            const DirNode* dir = nullptr;
+            bool got;
+            if (timed || tracing_queue) {
+                DirQueue::PopInfo how;
+                const auto t0 = stat_clock::now();
+                got = queue.pop_or_wait(id, dir, pending_dirs, stop_flag, &how);
+                const uint64_t waited_ns = elapsed_ns(t0);
+                stats.wait_ns.add(waited_ns);
+                if (tracing_queue) {
+                    if (how.waited)
+                        trace::wait(id, waited_ns);
+                    if (got && how.victim >= 0)
+                        trace::steal(id, how.victim);
+                }
+            }
+            else {
+                got = queue.pop_or_wait(id, dir, pending_dirs, stop_flag);
+            }
+            if (!got) {
+                if (pending_dirs.load() == 0 || stop_flag.load()) break;
+                continue;
+            }
+            if (timed) {
+                const auto t0 = stat_clock::now();
+                scan_dir(scan_dir, dir, 0);
+                const uint64_t elapsed = elapsed_ns(t0);
+                if (controller)
+                    controller->record(id, std::chrono::nanoseconds(elapsed));
+                stats.latency.record(elapsed);
+            }
+            else {
+                scan_dir(scan_dir, dir, 0);
+            }
+            queue.release(id); // до ожидания своей очереди в режиме auto, чтобы не держать место устройства
+
+            int remaining = pending_dirs.fetch_sub(1) - 1; // уменьшаем количество директорий на 1, если закончили с текущей
+            if (remaining == 0) {
+                wake_all();
+            }
+        }
+        if (!out.empty()) { // последняя неполная пачка, в том числе после отмены; вне обхода каталога, поэтому со своим catch
+            try {
+                flush();
+            }
+            catch (const std::exception& e) {
+                LOG_ERROR(std::string("Unexpected exception in match callback: ") + e.what());
+            }
+            catch (...) {
+                LOG_ERROR("Unknown exception in match callback");
+            }
+        }
+        if (on_done)
+            on_done(id);
+        if (logger.enabled(LogLevel::info)) {
+            std::ostringstream oss;
+            oss << "Thread finished. ID = " << std::this_thread::get_id();
+            LOG_INFO(oss.str());
+        }
+        trace::thread_stop(id);
+        };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    std::thread control;
+    if (controller)
+        control = std::thread([&] { controller->run([&] { return queue.size(); }); });
+
+    // ожидание завершения
+    for (auto& t : threads) {
+        if (t.joinable()) t.join();
+    }
+    if (control.joinable()) {
+        controller->finish(); // при ошибке в обходе потоки могли выйти без wake_all
+        control.join();
+    }
+    if (logger.enabled(LogLevel::debug)) {
+        size_t arena_bytes = 0;
+        for (const PathArena& a : arenas)
+            arena_bytes += a.bytes();
+        LOG_DEBUG("Directory nodes: " + std::to_string(arena_bytes) + " bytes");
+    }
+}
+
+MatchStream::MatchStream(SearchOptions options, size_t depth)
+    : eng(std::move(options)), depth(depth > 0 ? depth : static_cast<size_t>(eng.threads()) * 2) {
+    walker = std::thread([this] {
+        eng.run([this](int, MatchBatch& batch) {
+            std::unique_lock<std::mutex> lk(mtx);
+            room_cv.wait(lk, [&] { return ready.size() < this->depth || eng.cancelled(); });
+            if (eng.cancelled())
+                return;
+            // пачка уходит в очередь целиком, а поток обхода продолжает в уже выданной потребителем
+            MatchBatch next;
+            if (!spare.empty()) {
+                next = std::move(spare.back());
+                spare.pop_back();
+            }
+            std::swap(next, batch);
+            ready.push_back(std::move(next));
+            ready_cv.notify_one();
+        });
+        std::lock_guard<std::mutex> lk(mtx);
+        done = true;
+        ready_cv.notify_all();
+    });
+}
+
+MatchStream::~MatchStream() {
+    cancel();
+    if (walker.joinable())
+        walker.join();
+}
+
+bool MatchStream::next(MatchBatch& out) {
+    std::unique_lock<std::mutex> lk(mtx);
+    if (spare.size() < depth) { // прежняя пачка вернётся потоку обхода вместе со своей памятью
+        out.clear();
+        spare.push_back(std::move(out));
+    }
+    ready_cv.wait(lk, [&] { return !ready.empty() || done; });
+    if (ready.empty()) {
+        out.clear();
+        return false;
+    }
+    out = std::move(ready.front());
+    ready.pop_front();
+    room_cv.notify_one();
+    return true;
+}
+
+void MatchStream::cancel() {
+    eng.cancel();
+    std::lock_guard<std::mutex> lk(mtx);
+    room_cv.notify_all();
+}
@@ -0,0 +1,338 @@
+﻿#pragma once
+
+// движок поиска для встраивания в другие программы: обход каталогов потоками по общей очереди
+// с перехватом работы, сопоставление имён с шаблонами и фильтр по метаданным. Результаты отдаются
+// пачками — через обратный вызов из потоков обхода или по запросу потребителя (MatchStream);
+// пути лежат в памяти пачки и не копируются, пока потребитель сам этого не захочет.
+// Консольная FileFinder пользуется им же для обхода потоками
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "FsWalk.h"
+#include "DirQueue.h"
+
+class ListingCache;
+
+// гистограмма задержек в духе HDR: 16 линейных корзин на каждую степень двойки,
+// то есть погрешность не больше 1/16 на всём диапазоне от наносекунд до минут;
+// годится и для других неотрицательных величин, например глубины очереди в --stats
+class LatencyHistogram {
+public:
+    static constexpr unsigned sub = 16;
+    static constexpr size_t buckets = sub + (64 - 4) * sub;
+
+    void record(uint64_t ns) {
+        ++counts[index(ns)];
+        ++total;
+        if (ns > max_ns)
+            max_ns = ns;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < buckets; ++i)
+            counts[i] += other.counts[i];
+        total += other.total;
+        max_ns = std::max(max_ns, other.max_ns);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return max_ns; }
+
+    // значение, не меньше которого p долей замеров (0 < p <= 1); верхняя граница корзины
+    uint64_t percentile(double p) const {
+        if (total == 0)
+            return 0;
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * static_cast<double>(total) + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(upper(i), max_ns);
+        }
+        return max_ns;
+    }
+
+private:
+    static unsigned top_bit(uint64_t v) {
+        unsigned e = 0;
+        while (v >>= 1)
+            ++e;
+        return e;
+    }
+
+    static size_t index(uint64_t v) {
+        if (v < sub)
+            return static_cast<size_t>(v);
+        const unsigned e = top_bit(v);  // >= 4
+        return sub + (e - 4) * sub + static_cast<size_t>((v >> (e - 4)) - sub);
+    }
+
+    static uint64_t upper(size_t i) {
+        if (i < sub)
+            return i;
+        const size_t e = (i - sub) / sub + 4;
+        const uint64_t top = (i - sub) % sub + sub;
+        return ((top + 1) << (e - 4)) - 1;
+    }
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(buckets);
+    uint64_t total = 0;
+    uint64_t max_ns = 0;
+};
+
+// счётчик с единственным писателем: обычные load и store без lock-префикса,
+// а поток прогресса может читать его на ходу
+class StatCounter {
+public:
+    void add(uint64_t n) { v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    StatCounter& operator++() {
+        add(1);
+        return *this;
+    }
+    uint64_t get() const { return v.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v{ 0 };
+};
+
+// виды ошибок обхода в --stats
+enum class WalkError { access_denied, not_found, other_fs, exception };
+constexpr size_t walk_error_kinds = 4;
+
+inline WalkError classify_error(const std::error_code& ec) {
+    if (ec == std::errc::permission_denied)
+        return WalkError::access_denied;
+    if (ec == std::errc::no_such_file_or_directory || ec == std::errc::not_a_directory)
+        return WalkError::not_found;
+    return WalkError::other_fs;
+}
+
+// счётчики обхода одного потока; пишет только свой поток, остальные потоки читают
+// счётчики на ходу, а гистограмму — только после join
+struct alignas(64) WalkCounters {
+    StatCounter dirs;
+    StatCounter entries;
+    StatCounter matches;       // совпадения по имени, до проверки содержимого и квоты --limit
+    StatCounter wait_ns;       // ожидание работы в pop_or_wait
+    StatCounter scan_ns;       // перечисление каталогов без вложенного обхода подкаталогов
+    StatCounter errors[walk_error_kinds];
+    StatCounter revisits;      // каталоги, уже обойдённые по другому пути (--follow-links=always)
+    StatCounter cached;        // каталоги, имена которых взяты из кэша списков без перечисления
+    LatencyHistogram latency;  // обработка одного каталога, взятого из очереди
+
+    void error(WalkError kind) { ++errors[static_cast<size_t>(kind)]; }
+};
+
+// сумма счётчиков всех потоков после join
+struct WalkTotals {
+    uint64_t dirs = 0, entries = 0, matches = 0, wait_ns = 0, scan_ns = 0, revisits = 0, cached = 0;
+    uint64_t errors[walk_error_kinds] = {};
+    LatencyHistogram latency;
+
+    explicit WalkTotals(const std::vector<WalkCounters>& all) {
+        for (const WalkCounters& c : all) {
+            dirs += c.dirs.get();
+            entries += c.entries.get();
+            matches += c.matches.get();
+            wait_ns += c.wait_ns.get();
+            scan_ns += c.scan_ns.get();
+            revisits += c.revisits.get();
+            cached += c.cached.get();
+            for (size_t k = 0; k < walk_error_kinds; ++k)
+                errors[k] += c.errors[k].get();
+            latency.merge(c.latency);
+        }
+    }
+};
+
+// что и где искать; шаблоны разбираются вызывающим один раз и только читаются потоками обхода
+struct SearchOptions {
+    std::vector<std::filesystem::path> roots;  // стартовые каталоги, хотя бы один
+    NativePatterns patterns;
+    MetaFilter filter;
+    Pruner prune;
+    LinkPolicy links = LinkPolicy::root;
+    Backend backend = Backend::stl;            // iocp здесь обходится потоками через scan_nt
+    Traversal order = Traversal::dfs;
+    int threads = 0;                           // 0 — по числу аппаратных потоков
+    bool auto_threads = false;                 // threads — верхняя граница, сколько работает, решает контроллер
+    size_t max_queue = 1 << 20;                // сверх этого подкаталоги обходятся сразу, 0 — без предела
+    int device_threads = 0;                    // предел потоков на устройство, 0 — по типу устройства
+    bool timed = false;                        // замеры времени для WalkCounters (latency, wait_ns, scan_ns)
+    size_t batch = 256;                        // совпадений в пачке до передачи потребителю
+    long long limit = -1;                      // после стольких совпадений обход останавливается, -1 — без предела;
+                                               // найденные до остановки совпадения всё равно передаются, их может быть больше
+    std::atomic<bool>* stop = nullptr;         // внешний флаг отмены; nullptr — только cancel()
+    ListingCache* listings = nullptr;          // кэш списков каталогов; читает и сохраняет вызывающий
+};
+
+// найденный файл; path указывает в память пачки и действителен, пока пачку не очистили
+struct FoundFile {
+    native_view path;
+    int pattern; // номер шаблона в SearchOptions::patterns
+};
+
+// пачка совпадений одного потока: пути подряд в одном буфере, без выделения памяти на каждый файл.
+// Пачку можно забрать себе перемещением (std::swap с пустой) — данные при этом не копируются
+class MatchBatch {
+public:
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    FoundFile operator[](size_t i) const {
+        const Entry& e = entries[i];
+        return FoundFile{ native_view(text.data() + e.off, e.len), e.pattern };
+    }
+
+    void add(native_view path, int pattern) {
+        entries.push_back(Entry{ text.size(), path.size(), pattern });
+        text.append(path);
+    }
+
+    void clear() { // память остаётся для следующей пачки
+        text.clear();
+        entries.clear();
+    }
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FoundFile;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = FoundFile;
+
+        iterator(const MatchBatch* b, size_t i) : b(b), i(i) {}
+        FoundFile operator*() const { return (*b)[i]; }
+        iterator& operator++() {
+            ++i;
+            return *this;
+        }
+        bool operator==(const iterator& o) const { return i == o.i; }
+        bool operator!=(const iterator& o) const { return i != o.i; }
+
+    private:
+        const MatchBatch* b;
+        size_t i;
+    };
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, entries.size()); }
+
+private:
+    struct Entry {
+        size_t off;
+        size_t len;
+        int pattern;
+    };
+    native_string text;
+    std::vector<Entry> entries;
+};
+
+// вызывается из потока обхода thread (0 .. threads() - 1) с полной или последней пачкой;
+// вызовы разных потоков идут одновременно. После возврата пачка очищается и заполняется дальше;
+// исключение из вызова прерывает обход текущего каталога, но пачка очищается и тогда
+using BatchCallback = std::function<void(int thread, MatchBatch& batch)>;
+// поток обхода thread закончил: пачек от него больше не будет
+using ThreadDoneCallback = std::function<void(int thread)>;
+
+class FinderEngine {
+public:
+    explicit FinderEngine(SearchOptions options);
+    ~FinderEngine();
+    FinderEngine(const FinderEngine&) = delete;
+    FinderEngine& operator=(const FinderEngine&) = delete;
+
+    // обход всех стартовых каталогов до конца или до отмены; блокирует вызывающий поток.
+    // Запускается один раз на объект
+    void run(const BatchCallback& on_batch, const ThreadDoneCallback& on_done = {});
+
+    // остановка обхода из любого потока, в том числе из обратного вызова
+    void cancel();
+    bool cancelled() const;
+
+    int threads() const;                              // потоков обхода, с auto — верхняя граница
+    size_t queued() const;                            // каталогов в очереди, можно читать на ходу
+    const std::vector<WalkCounters>& counters() const; // по потоку; гистограммы — только после run
+    const SearchOptions& options() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> st;
+};
+
+// результаты в стиле «тяни сам»: обход идёт в фоновом потоке, готовые пачки ждут в очереди
+// не длиннее depth пачек, а когда потребитель отстаёт, потоки обхода ждут его.
+// Разрушение потока результатов до конца обхода отменяет обход
+class MatchStream {
+public:
+    explicit MatchStream(SearchOptions options, size_t depth = 0);
+    ~MatchStream();
+    MatchStream(const MatchStream&) = delete;
+    MatchStream& operator=(const MatchStream&) = delete;
+
+    // следующая пачка; прежнее содержимое out уходит на повторное использование.
+    // false — обход закончен и все пачки выданы
+    bool next(MatchBatch& out);
+
+    void cancel();
+    FinderEngine& engine() { return eng; }
+
+    // перебор по одному файлу: for (FoundFile f : stream) ...; f.path действителен до следующего шага
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = FoundFile;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = FoundFile;
+
+        explicit iterator(MatchStream* s = nullptr) : s(s) { advance(); }
+        FoundFile operator*() const { return s->current[s->pos]; }
+        iterator& operator++() {
+            ++s->pos;
+            advance();
+            return *this;
+        }
+        bool operator==(const iterator& o) const { return s == o.s; }
+        bool operator!=(const iterator& o) const { return s != o.s; }
+
+    private:
+        void advance() {
+            while (s && s->pos >= s->current.size()) {
+                s->pos = 0;
+                if (!s->next(s->current))
+                    s = nullptr;
+            }
+        }
+        MatchStream* s;
+    };
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    FinderEngine eng;
+    const size_t depth;
+    std::mutex mtx;
+    std::condition_variable ready_cv; // появилась пачка или обход закончен
+    std::condition_variable room_cv;  // в очереди освободилось место или отмена
+    std::deque<MatchBatch> ready;
+    std::vector<MatchBatch> spare;    // выданные потребителю пачки, готовые к повторному заполнению
+    bool done = false;
+    MatchBatch current; // для iterator
+    size_t pos = 0;
+    std::thread walker;
+};
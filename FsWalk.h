@@ -0,0 +1,705 @@
+﻿#pragma once
+
+// обход файловой системы без состояния программы: пути, метаданные и фильтр по ним, узлы
+// каталогов, отсечение поддеревьев, ссылки, устройства и перечисление одного каталога.
+// Вынесено из FileFinder.cpp, чтобы FinderEngine и консольная программа пользовались одним кодом
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "Wildcard.h"
+
+namespace fs = std::filesystem;
+
+// имя файла как хвост полного пути, без выделения памяти под fs::path
+inline native_view filename_view(const fs::path& p) {
+    native_view full = p.native();
+#ifdef _WIN32
+    size_t pos = full.find_last_of(L"\\/");
+#else
+    size_t pos = full.find_last_of('/');
+#endif
+    return pos == native_view::npos ? full : full.substr(pos + 1);
+}
+
+// дописывание компонента пути с разделителем, как это делает fs::path::operator/
+inline void append_component(native_string& path, native_view name) {
+    if (!path.empty()) {
+        const native_char last = path.back();
+#ifdef _WIN32
+        if (last != L'\\' && last != L'/' && last != L':')
+            path += L'\\';
+#else
+        if (last != '/')
+            path += '/';
+#endif
+    }
+    path.append(name.data(), name.size());
+}
+
+// путь в узкой кодировке для вывода и лога. В Windows — кодовая страница, что и у fs::path::string(),
+// но без исключения: символы, которых в ней нет (иероглифы при кодовой странице 1251), заменяются
+// на '?', иначе одно такое имя обрывало бы поток обхода
+inline std::string path_string(native_view p) {
+#ifdef _WIN32
+    std::string out;
+    if (p.empty())
+        return out;
+    const UINT cp = AreFileApisANSI() ? CP_ACP : CP_OEMCP;
+    const int wlen = static_cast<int>(p.size());
+    const int n = WideCharToMultiByte(cp, WC_NO_BEST_FIT_CHARS, p.data(), wlen, nullptr, 0, nullptr, nullptr);
+    if (n <= 0)
+        return out;
+    out.resize(n);
+    WideCharToMultiByte(cp, WC_NO_BEST_FIT_CHARS, p.data(), wlen, &out[0], n, nullptr, nullptr);
+    return out;
+#else
+    return std::string(p);
+#endif
+}
+
+// путь в UTF-8 прямо в конец out, без временных строк и без кодовой страницы консоли;
+// в остальных системах имена уже байтовые и копируются как есть
+inline void append_utf8(std::string& out, native_view p) {
+#ifdef _WIN32
+    if (p.empty())
+        return;
+    const int wlen = static_cast<int>(p.size());
+    const int n = WideCharToMultiByte(CP_UTF8, 0, p.data(), wlen, nullptr, 0, nullptr, nullptr);
+    const size_t base = out.size();
+    out.resize(base + n);
+    WideCharToMultiByte(CP_UTF8, 0, p.data(), wlen, &out[base], n, nullptr, nullptr);
+#else
+    out.append(p.data(), p.size());
+#endif
+}
+
+// атрибуты в FileMeta; значения совпадают с FILE_ATTRIBUTE_*, чтобы на Windows брать их из записи как есть
+constexpr uint32_t attr_readonly = 0x1;
+constexpr uint32_t attr_hidden = 0x2;
+constexpr uint32_t attr_system = 0x4;
+
+// какие поля FileMeta нужны фильтру; обходчики, у которых метаданные лежат прямо в записи каталога,
+// заполняют все, а обход через std::filesystem запрашивает только нужные
+constexpr unsigned need_size = 1, need_time = 2, need_attrs = 4;
+
+// метаданные файла из записи каталога
+struct FileMeta {
+    uint64_t size = 0;
+    int64_t mtime = 0;  // секунды от 1970-01-01 UTC
+    uint32_t attrs = 0;
+};
+
+#ifdef _WIN32
+// FILETIME (100 нс от 1601 года) в секунды Unix
+inline int64_t filetime_to_unix(int64_t ft) {
+    return ft / 10000000 - 11644473600LL;
+}
+#endif
+
+// фильтр по метаданным; пустой фильтр пропускает всё и ничего не запрашивает
+class MetaFilter {
+public:
+    uint64_t min_size = 0;
+    uint64_t max_size = UINT64_MAX;
+    int64_t newer = INT64_MIN;  // mtime >= newer
+    int64_t older = INT64_MAX;  // mtime < older
+    uint32_t require = 0;       // все эти атрибуты должны быть
+    uint32_t reject = 0;        // ни одного из этих
+
+    unsigned needs() const {
+        return (min_size != 0 || max_size != UINT64_MAX ? need_size : 0) |
+            (newer != INT64_MIN || older != INT64_MAX ? need_time : 0) |
+            (require | reject ? need_attrs : 0);
+    }
+
+    bool active() const { return needs() != 0; }
+
+    bool match(const FileMeta& m) const {
+        return m.size >= min_size && m.size <= max_size && m.mtime >= newer && m.mtime < older &&
+            (m.attrs & require) == require && (m.attrs & reject) == 0;
+    }
+
+    // размер вида 1500, 64K, 10M, 1G, 2T (двоичные приставки)
+    static bool parse_size(const std::string& text, uint64_t& out) {
+        char* end = nullptr;
+        const double v = std::strtod(text.c_str(), &end);
+        if (text.empty() || end == text.c_str() || v < 0)
+            return false;
+        double mul = 1;
+        switch (std::toupper(static_cast<unsigned char>(*end))) {
+        case '\0': break;
+        case 'K': mul = 1024.0; ++end; break;
+        case 'M': mul = 1024.0 * 1024; ++end; break;
+        case 'G': mul = 1024.0 * 1024 * 1024; ++end; break;
+        case 'T': mul = 1024.0 * 1024 * 1024 * 1024; ++end; break;
+        default: return false;
+        }
+        if (*end == 'B' || *end == 'b')
+            ++end;
+        if (*end != '\0')
+            return false;
+        out = static_cast<uint64_t>(v * mul);
+        return true;
+    }
+
+    // дата YYYY-MM-DD или YYYY-MM-DD HH:MM[:SS] по местному времени
+    static bool parse_time(const std::string& text, int64_t& out) {
+        std::tm tm{};
+        int n = std::sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+        if (n < 3 || n == 4 || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31)
+            return false;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        const std::time_t t = std::mktime(&tm);
+        if (t == static_cast<std::time_t>(-1))
+            return false;
+        out = static_cast<int64_t>(t);
+        return true;
+    }
+};
+
+// каталог в очереди обхода: ссылка на родителя и имя, лежащее сразу за узлом в арене;
+// полный путь собирается по цепочке родителей только перед открытием каталога.
+// Узлы неизменяемы после постановки в очередь, поэтому их безопасно читать из любого потока
+struct IgnoreRules;
+
+struct DirNode {
+    const DirNode* parent;
+    const IgnoreRules* rules;  // действующие правила игнорирования, обычно унаследованные от родителя
+    uint32_t len;
+    uint32_t depth;            // 0 — стартовый каталог
+
+    native_view name() const { return native_view(reinterpret_cast<const native_char*>(this + 1), len); }
+
+    void path(native_string& out) const {
+        thread_local std::vector<const DirNode*> chain;
+        chain.clear();
+        for (const DirNode* n = this; n; n = n->parent)
+            chain.push_back(n);
+        out.clear();
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            append_component(out, (*it)->name());
+    }
+};
+
+// арена узлов одного потока: выделение сдвигом указателя в крупных блоках,
+// освобождение всех узлов разом вместе с ареной
+class PathArena {
+public:
+    static constexpr size_t block_size = 1 << 18; // 256 КиБ
+
+    PathArena() = default;
+    PathArena(const PathArena&) = delete;
+    PathArena& operator=(const PathArena&) = delete;
+
+    DirNode* make(const DirNode* parent, native_view name) {
+        const size_t need = (sizeof(DirNode) + name.size() * sizeof(native_char) + alignof(DirNode) - 1) & ~(alignof(DirNode) - 1);
+        if (need > left) {
+            const size_t size = std::max(block_size, need);
+            blocks.emplace_back(new unsigned char[size]);
+            cur = blocks.back().get();
+            left = size;
+        }
+        DirNode* node = reinterpret_cast<DirNode*>(cur);
+        node->parent = parent;
+        node->rules = parent ? parent->rules : nullptr;
+        node->len = static_cast<uint32_t>(name.size());
+        node->depth = parent ? parent->depth + 1 : 0;
+        std::copy(name.begin(), name.end(), reinterpret_cast<native_char*>(node + 1));
+        cur += need;
+        left -= need;
+        used += need;
+        return node;
+    }
+
+    size_t bytes() const { return used; }
+
+private:
+    std::vector<std::unique_ptr<unsigned char[]>> blocks;
+    unsigned char* cur = nullptr;
+    size_t left = 0;
+    size_t used = 0;
+};
+
+// правила из файла игнорирования (подмножество .gitignore): шаблоны имён, '#' — комментарий,
+// '/' в конце — только каталоги, '/' в начале — только записи каталога, где лежит файл,
+// ведущий "**/" отбрасывается; отрицания '!' и шаблоны с '/' внутри не поддерживаются.
+// Правила наследуются подкаталогами по цепочке parent
+struct IgnoreRules {
+    const IgnoreRules* parent = nullptr;
+    const DirNode* owner = nullptr;  // каталог, в котором лежит файл
+    NativePatterns any, dirs_only, anchored, anchored_dirs;
+
+    bool load(const fs::path& file) {
+        std::ifstream in(file);
+        if (!in)
+            return false;
+        for (std::string line; std::getline(in, line);) {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+                line.pop_back();
+            if (line.empty() || line[0] == '#' || line[0] == '!')
+                continue;
+            if (line.rfind("**/", 0) == 0)
+                line.erase(0, 3);
+            const bool dir_only = line.size() > 1 && line.back() == '/';
+            if (dir_only)
+                line.pop_back();
+            const bool rooted = line.size() > 1 && line[0] == '/';
+            if (rooted)
+                line.erase(0, 1);
+            if (line.empty() || line.find('/') != std::string::npos)
+                continue;
+            const native_string p = fs::u8path(line).native();
+            (rooted ? (dir_only ? anchored_dirs : anchored) : (dir_only ? dirs_only : any)).add(p);
+        }
+        return true;
+    }
+
+    // игнорируется ли запись каталога dir с учётом всех унаследованных правил
+    static bool ignored(const IgnoreRules* rules, const DirNode* dir, native_view name, bool is_dir) {
+        for (const IgnoreRules* r = rules; r; r = r->parent) {
+            if (r->any.match(name) >= 0 || (is_dir && r->dirs_only.match(name) >= 0))
+                return true;
+            if (r->owner == dir && (r->anchored.match(name) >= 0 || (is_dir && r->anchored_dirs.match(name) >= 0)))
+                return true;
+        }
+        return false;
+    }
+};
+
+// отсечение поддеревьев до постановки в очередь: --exclude, --max-depth и файлы игнорирования
+struct Pruner {
+    NativePatterns exclude;
+    bool has_exclude = false;
+    uint32_t max_depth = UINT32_MAX;  // уровней подкаталогов ниже стартового
+    native_string ignore_name;        // пусто — файлы игнорирования не читаются
+
+    bool active() const { return has_exclude || max_depth != UINT32_MAX || !ignore_name.empty(); }
+
+    bool skip_dir(const DirNode* parent, native_view name) const {
+        return parent->depth + 1 > max_depth || (has_exclude && exclude.match(name) >= 0) ||
+            IgnoreRules::ignored(parent->rules, parent, name, true);
+    }
+
+    bool skip_file(const DirNode* parent, native_view name) const {
+        return (has_exclude && exclude.match(name) >= 0) || IgnoreRules::ignored(parent->rules, parent, name, false);
+    }
+};
+
+// переход по ссылкам на каталоги: символическим ссылкам и junction-точкам
+enum class LinkPolicy {
+    never,  // ссылка — обычная запись: сопоставляется с шаблоном как файл, внутрь обход не идёт
+    root,   // переход только по стартовому пути, если он сам ссылка (как find -H)
+    always, // переход по всем ссылкам; каждый каталог обходится один раз, повторы и циклы отсекаются
+};
+
+// каталог на диске: серийный номер тома и номер файла (128 бит — на ReFS номер шире 64)
+struct DirIdentity {
+    uint64_t volume = 0;
+    uint64_t id_lo = 0;
+    uint64_t id_hi = 0;
+
+    bool operator==(const DirIdentity& o) const { return volume == o.volume && id_lo == o.id_lo && id_hi == o.id_hi; }
+};
+
+// множество уже обойдённых каталогов для --follow-links=always: шарды со своими мьютексами,
+// шард выбирается по хешу, поэтому потоки почти не ждут друг друга
+class VisitedDirs {
+public:
+    // true, если каталог встретился впервые
+    bool insert(const DirIdentity& id) {
+        const size_t h = Hash()(id);
+        Shard& shard = shards[(h >> 7) % shard_count]; // младшие биты хеша достаются самой таблице шарда
+        std::lock_guard<std::mutex> lk(shard.mtx);
+        return shard.set.insert(id).second;
+    }
+
+    struct Hash {
+        size_t operator()(const DirIdentity& d) const {
+            uint64_t h = d.id_lo * 0x9E3779B97F4A7C15ull;
+            h ^= (d.id_hi + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2));
+            h ^= (d.volume + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2));
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+    };
+
+private:
+    static constexpr size_t shard_count = 64;
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_set<DirIdentity, Hash> set;
+    };
+    Shard shards[shard_count];
+};
+
+#ifdef _WIN32
+// идентификатор по открытому дескриптору
+inline bool dir_identity(HANDLE h, DirIdentity& out) {
+    FILE_ID_INFO info;
+    if (GetFileInformationByHandleEx(h, FileIdInfo, &info, sizeof(info))) {
+        out.volume = info.VolumeSerialNumber;
+        std::memcpy(&out.id_lo, info.FileId.Identifier, sizeof(out.id_lo));
+        std::memcpy(&out.id_hi, info.FileId.Identifier + sizeof(out.id_lo), sizeof(out.id_hi));
+        return true;
+    }
+    BY_HANDLE_FILE_INFORMATION bh; // FileIdInfo нет до Windows 8 и на части сетевых ФС
+    if (!GetFileInformationByHandle(h, &bh))
+        return false;
+    out.volume = bh.dwVolumeSerialNumber;
+    out.id_lo = (static_cast<uint64_t>(bh.nFileIndexHigh) << 32) | bh.nFileIndexLow;
+    out.id_hi = 0;
+    return true;
+}
+#endif
+
+// идентификатор каталога по пути; false, если каталог не открылся
+inline bool dir_identity(const native_string& path, DirIdentity& out) {
+#ifdef _WIN32
+    const HANDLE h = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    const bool ok = dir_identity(h, out);
+    CloseHandle(h);
+    return ok;
+#else
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return false;
+    out.volume = static_cast<uint64_t>(st.st_dev);
+    out.id_lo = static_cast<uint64_t>(st.st_ino);
+    out.id_hi = 0;
+    return true;
+#endif
+}
+
+// устройство, на котором лежит стартовый путь: по нему стартовые пути делятся на группы
+// со своим пределом потоков
+struct DeviceInfo {
+    std::string key;         // физический диск, сервер сетевой папки или, если их не узнать, том
+    bool rotational = false; // диск с механическим позиционированием головок
+    bool remote = false;     // сетевая папка
+};
+
+#ifdef _WIN32
+inline DeviceInfo device_of(const fs::path& path) {
+    DeviceInfo d;
+    std::error_code ec;
+    const std::wstring p = fs::absolute(path, ec).native();
+    // \\server\share\...: одна группа на сервер, у разных папок одного сервера общий канал
+    if (p.size() > 2 && p[0] == L'\\' && p[1] == L'\\' && p[2] != L'?' && p[2] != L'.') {
+        std::wstring server = p.substr(0, p.find(L'\\', 2));
+        std::transform(server.begin(), server.end(), server.begin(), [](wchar_t c) { return fold_char(c); });
+        d.key = path_string(server);
+        d.remote = true;
+        return d;
+    }
+    wchar_t volume[MAX_PATH];
+    if (!GetVolumePathNameW(p.c_str(), volume, MAX_PATH)) {
+        d.key = path_string(p.substr(0, 3));
+        return d;
+    }
+    d.key = path_string(volume);
+    if (GetDriveTypeW(volume) == DRIVE_REMOTE) {
+        d.remote = true;
+        return d;
+    }
+    wchar_t guid[MAX_PATH]; // \\?\Volume{...}\ ; без завершающей '\' это устройство тома
+    if (!GetVolumeNameForVolumeMountPointW(volume, guid, MAX_PATH))
+        return d;
+    std::wstring device = guid;
+    if (!device.empty() && device.back() == L'\\')
+        device.pop_back();
+    // запросы ниже не требуют прав на чтение тома
+    const HANDLE h = CreateFileW(device.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return d;
+    DWORD bytes = 0;
+    STORAGE_DEVICE_NUMBER number{};
+    if (DeviceIoControl(h, IOCTL_STORAGE_GET_DEVICE_NUMBER, nullptr, 0, &number, sizeof(number), &bytes, nullptr))
+        d.key = "disk " + std::to_string(number.DeviceNumber); // разделы одного диска — одна группа
+    STORAGE_PROPERTY_QUERY query{};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_SEEK_PENALTY_DESCRIPTOR seek{};
+    if (DeviceIoControl(h, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &seek, sizeof(seek), &bytes, nullptr) &&
+        bytes >= sizeof(seek))
+        d.rotational = seek.IncursSeekPenalty != FALSE;
+    CloseHandle(h);
+    return d;
+}
+#else
+inline DeviceInfo device_of(const fs::path& path) {
+    DeviceInfo d;
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        d.key = path.string();
+        return d;
+    }
+    const std::string dev = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+    d.key = "dev " + dev;
+    // блочное устройство раздела ведёт в sysfs к диску, которому раздел принадлежит;
+    // у сетевых и виртуальных ФС записи в /sys/dev/block нет
+    std::error_code ec;
+    fs::path block = fs::canonical("/sys/dev/block/" + dev, ec);
+    if (ec)
+        return d;
+    if (fs::exists(block / "partition", ec))
+        block = block.parent_path();
+    d.key = block.filename().string();
+    std::ifstream rot(block / "queue" / "rotational");
+    char flag = '0';
+    d.rotational = (rot >> flag) && flag == '1';
+    return d;
+}
+#endif
+
+// способ перечисления содержимого каталога
+enum class Backend {
+    stl,    // std::filesystem::directory_iterator
+    win32,  // FindFirstFileExW + FIND_FIRST_EX_LARGE_FETCH
+    nt,     // GetFileInformationByHandleEx(FileIdExtdDirectoryInfo) с большим буфером
+    iocp,   // асинхронный NtQueryDirectoryFile через порт завершения, вместо блокирующих рабочих потоков
+};
+
+inline const char* backend_name(Backend b) {
+    switch (b) {
+    case Backend::win32: return "win32";
+    case Backend::nt: return "nt";
+    case Backend::iocp: return "iocp";
+    default: return "stl";
+    }
+}
+
+// метаданные из directory_entry: на Windows размер и время уже лежат в нём после перечисления,
+// в остальных системах каждое поле стоит stat, поэтому читаются только запрошенные
+inline FileMeta stl_meta(const fs::directory_entry& entry, unsigned need) {
+    FileMeta m;
+    std::error_code ec;
+    if (need & need_size) {
+        const auto size = entry.file_size(ec);
+        m.size = ec ? 0 : static_cast<uint64_t>(size);
+    }
+    if (need & need_time) {
+        // в C++17 нет clock_cast: перевод через разницу с текущим моментом обоих часов
+        const auto ft = entry.last_write_time(ec);
+        if (!ec) {
+            const auto sys = std::chrono::system_clock::now() +
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(ft - fs::file_time_type::clock::now());
+            m.mtime = std::chrono::duration_cast<std::chrono::seconds>(sys.time_since_epoch()).count();
+        }
+    }
+    if (need & need_attrs) {
+#ifdef _WIN32
+        const DWORD a = GetFileAttributesW(entry.path().c_str()); // std::filesystem атрибутов не отдаёт
+        m.attrs = (a == INVALID_FILE_ATTRIBUTES) ? 0 : a;
+#else
+        const native_view name = filename_view(entry.path());
+        if (!name.empty() && name[0] == '.')
+            m.attrs |= attr_hidden;
+        const auto st = entry.status(ec);
+        if (!ec && (st.permissions() & fs::perms::owner_write) == fs::perms::none)
+            m.attrs |= attr_readonly;
+#endif
+    }
+    return m;
+}
+
+// ссылка на каталог или файл: символическая ссылка, а в MSVC ещё и junction-точка
+inline bool is_link(const fs::directory_entry& entry, std::error_code& ec) {
+    const fs::file_type t = entry.symlink_status(ec).type();
+#ifdef _MSC_VER
+    return t == fs::file_type::symlink || t == fs::file_type::junction;
+#else
+    return t == fs::file_type::symlink;
+#endif
+}
+
+// обход через std::filesystem; on_dir(имя) для подкаталогов, on_file(имя, meta) для файлов,
+// где meta(need) отдаёт FileMeta; stop прерывает перечисление на следующей записи.
+// Ссылки на каталоги обходятся как каталоги, только если follow_links, иначе идут в on_file.
+// Ошибки не бросаются, а передаются в on_error(операция, путь, код): ошибка открытия или
+// чтения каталога заканчивает его перечисление, ошибка одной записи пропускает только её
+template <class OnDir, class OnFile, class OnError>
+void scan_stl(const fs::path& dir, const std::atomic<bool>& stop, bool follow_links, OnDir&& on_dir, OnFile&& on_file, OnError&& on_error) {
+    std::error_code ec;
+    fs::directory_iterator it(dir, fs::directory_options::none, ec);
+    if (ec) {
+        on_error("directory_iterator", dir.native(), ec);
+        return;
+    }
+    for (const fs::directory_iterator end; it != end; it.increment(ec)) {
+        if (stop.load(std::memory_order_relaxed))
+            return;
+        const fs::directory_entry& entry = *it;
+        // запись, исчезнувшая после чтения каталога, или висячая ссылка дают not_found — это не ошибка
+        std::error_code entry_ec;
+        if (!follow_links && is_link(entry, entry_ec)) {
+            on_file(filename_view(entry.path()), [&](unsigned need) { return stl_meta(entry, need); });
+        }
+        else if (entry.is_directory(entry_ec)) {
+            on_dir(filename_view(entry.path()));
+        }
+        else if (entry_ec && entry_ec != std::errc::no_such_file_or_directory) {
+            on_error("is_directory", entry.path().native(), entry_ec);
+        }
+        else if (entry.is_regular_file(entry_ec) || entry.is_symlink(entry_ec)) {
+            on_file(filename_view(entry.path()), [&](unsigned need) { return stl_meta(entry, need); });
+        }
+    }
+    if (ec)
+        on_error("directory_iterator::increment", dir.native(), ec);
+}
+
+#ifdef _WIN32
+// закрытие поискового дескриптора при любом выходе из scan_win32
+struct FindHandle {
+    HANDLE h = INVALID_HANDLE_VALUE;
+    ~FindHandle() { if (h != INVALID_HANDLE_VALUE) FindClose(h); }
+};
+
+// обход через FindFirstFileExW: тип записи берётся прямо из dwFileAttributes,
+// имя передаётся в on_file как есть, без перевода в узкую кодировку
+template <class OnDir, class OnFile, class OnError>
+void scan_win32(const std::wstring& dir, const std::atomic<bool>& stop, bool follow_links, OnDir&& on_dir, OnFile&& on_file, OnError&& on_error) {
+    thread_local std::wstring mask;
+    mask.assign(dir);
+    if (!mask.empty() && mask.back() != L'\\' && mask.back() != L'/')
+        mask += L'\\';
+    mask += L'*';
+
+    WIN32_FIND_DATAW fd;
+    FindHandle fh;
+    fh.h = FindFirstFileExW(mask.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (fh.h == INVALID_HANDLE_VALUE) {
+        DWORD err = GetLastError();
+        if (err != ERROR_FILE_NOT_FOUND) // ERROR_FILE_NOT_FOUND — пустой корень тома
+            on_error("FindFirstFileExW", dir, std::error_code(static_cast<int>(err), std::system_category()));
+        return;
+    }
+
+    do {
+        if (stop.load(std::memory_order_relaxed))
+            return;
+        const wchar_t* name = fd.cFileName;
+        if (name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0')))
+            continue;
+        // у точки повторного анализа тег лежит в dwReserved0; ссылки — только теги-суррогаты имён
+        const bool link = (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && IsReparseTagNameSurrogate(fd.dwReserved0);
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (follow_links || !link))
+            on_dir(std::wstring_view(name));
+        else
+            on_file(std::wstring_view(name), [&](unsigned) {
+                return FileMeta{ (static_cast<uint64_t>(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow,
+                    filetime_to_unix((static_cast<int64_t>(fd.ftLastWriteTime.dwHighDateTime) << 32) | fd.ftLastWriteTime.dwLowDateTime),
+                    fd.dwFileAttributes };
+            });
+    } while (FindNextFileW(fh.h, &fd));
+
+    DWORD err = GetLastError();
+    if (err != ERROR_NO_MORE_FILES)
+        on_error("FindNextFileW", dir, std::error_code(static_cast<int>(err), std::system_category()));
+}
+
+// закрытие обычного дескриптора
+struct HandleGuard {
+    HANDLE h = INVALID_HANDLE_VALUE;
+    ~HandleGuard() { if (h != INVALID_HANDLE_VALUE) CloseHandle(h); }
+};
+
+constexpr DWORD nt_buffer_size = 1 << 20; // буфер перечисления на поток, 1 МиБ
+
+// обход через GetFileInformationByHandleEx: один вызов заполняет весь буфер,
+// поэтому на огромных плоских каталогах системных вызовов на порядок меньше
+template <class OnDir, class OnFile, class OnError>
+void scan_nt(const std::wstring& dir, const std::atomic<bool>& stop, bool follow_links, OnDir&& on_dir, OnFile&& on_file, OnError&& on_error) {
+    HandleGuard dh;
+    dh.h = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (dh.h == INVALID_HANDLE_VALUE) {
+        on_error("CreateFileW", dir, std::error_code(static_cast<int>(GetLastError()), std::system_category()));
+        return;
+    }
+
+    // ULONGLONG — записи FILE_ID_EXTD_DIR_INFO требуют выравнивания по 8 байт;
+    // свой буфер на каждый уровень вложенности, т.к. on_dir может обойти подкаталог прямо изнутри вызова
+    thread_local std::deque<std::vector<ULONGLONG>> buffers;
+    thread_local size_t depth = 0;
+    if (buffers.size() <= depth)
+        buffers.emplace_back(nt_buffer_size / sizeof(ULONGLONG));
+    std::vector<ULONGLONG>& buffer = buffers[depth];
+    struct DepthGuard {
+        ~DepthGuard() { --depth; }
+    } depth_guard;
+    ++depth;
+
+    FILE_INFO_BY_HANDLE_CLASS info_class = FileIdExtdDirectoryRestartInfo;
+    while (true) {
+        if (!GetFileInformationByHandleEx(dh.h, info_class, buffer.data(), nt_buffer_size)) {
+            DWORD err = GetLastError();
+            if (err == ERROR_NO_MORE_FILES || err == ERROR_FILE_NOT_FOUND)
+                break;
+            if (info_class == FileIdExtdDirectoryRestartInfo && (err == ERROR_INVALID_PARAMETER || err == ERROR_NOT_SUPPORTED)) {
+                scan_win32(dir, stop, follow_links, on_dir, on_file, on_error); // ФС не поддерживает этот класс (FAT, часть SMB-серверов)
+                return;
+            }
+            on_error("GetFileInformationByHandleEx", dir, std::error_code(static_cast<int>(err), std::system_category()));
+            return;
+        }
+        info_class = FileIdExtdDirectoryInfo;
+        if (stop.load(std::memory_order_relaxed))
+            return;
+
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(buffer.data());
+        while (true) {
+            const auto* info = reinterpret_cast<const FILE_ID_EXTD_DIR_INFO*>(p);
+            std::wstring_view name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            if (name != L"." && name != L"..") {
+                const bool link = (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && IsReparseTagNameSurrogate(info->ReparsePointTag);
+                if ((info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (follow_links || !link))
+                    on_dir(name);
+                else
+                    on_file(name, [&](unsigned) {
+                        return FileMeta{ static_cast<uint64_t>(info->EndOfFile.QuadPart),
+                            filetime_to_unix(info->LastWriteTime.QuadPart), info->FileAttributes };
+                    });
+            }
+            if (info->NextEntryOffset == 0)
+                break;
+            p += info->NextEntryOffset;
+        }
+    }
+}
+#endif
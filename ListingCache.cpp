@@ -0,0 +1,246 @@
+﻿#include "ListingCache.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unordered_set>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
+#include "FsWalk.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char cache_magic[8] = { 'F', 'F', 'L', 'I', 'S', 'T', 'S', '1' };
+constexpr uint32_t cache_version = 1;
+
+// заголовок файла кэша; за ним идут dir_count записей DirHeader, каждая со своим путём,
+// entry_count записями Entry и name_count символами пула имён
+struct CacheHeader {
+    char magic[8];        // "FFLISTS1"
+    uint32_t version;
+    uint32_t char_size;   // sizeof(native_char): файл из Windows в Linux не читается, и наоборот
+    uint32_t flags;       // бит 0 — follow_links
+    uint32_t reserved;
+    uint64_t dir_count;
+};
+
+struct DirHeader {
+    int64_t stamp;
+    uint32_t path_len;    // в native_char
+    uint32_t entry_count;
+    uint32_t name_count;  // в native_char
+    uint32_t reserved;
+};
+
+constexpr uint32_t flag_follow_links = 0x1;
+
+#ifdef _WIN32
+// на FAT отметка времени каталога грубее секунды, на SMB её может округлять сервер
+constexpr int64_t racy_window = 3 * 10000000LL; // 3 с в единицах FILETIME
+
+int64_t stamp_now() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return static_cast<int64_t>((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+}
+#else
+constexpr int64_t racy_window = 3 * 1000000000LL; // 3 с в наносекундах
+
+int64_t stamp_now() {
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+#endif
+
+// хватает ли в остатке файла места на count элементов T; счётчики взяты из файла,
+// поэтому проверка делением и до выделения памяти под них
+template <class T>
+bool fits(const char* p, const char* end, uint64_t count) {
+    return count <= static_cast<uint64_t>(end - p) / sizeof(T);
+}
+
+template <class T>
+bool take(const char*& p, const char* end, T* out, size_t count) {
+    if (!fits<T>(p, end, count))
+        return false;
+    const size_t bytes = count * sizeof(T);
+    std::memcpy(out, p, bytes);
+    p += bytes;
+    return true;
+}
+
+}
+
+bool ListingCache::dir_stamp(const native_string& dir, int64_t& stamp) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(dir.c_str(), GetFileExInfoStandard, &data))
+        return false;
+    stamp = static_cast<int64_t>((static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0)
+        return false;
+    stamp = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+ListingCache::ReadStatus ListingCache::read(const fs::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+        return ReadStatus::missing;
+    const std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const char* p = data.data();
+    const char* const end = p + data.size();
+
+    CacheHeader h{};
+    if (!take(p, end, &h, 1) || std::memcmp(h.magic, cache_magic, sizeof(cache_magic)) != 0 || h.version != cache_version ||
+        h.char_size != sizeof(native_char))
+        return ReadStatus::corrupt;
+    if (((h.flags & flag_follow_links) != 0) != follow)
+        return ReadStatus::other_mode;
+
+    std::unordered_map<native_string, Listing> loaded;
+    loaded.reserve(static_cast<size_t>(std::min<uint64_t>(h.dir_count, data.size() / sizeof(DirHeader))));
+    for (uint64_t i = 0; i < h.dir_count; ++i) {
+        DirHeader d{};
+        if (!take(p, end, &d, 1))
+            return ReadStatus::corrupt;
+        // все три части записи идут подряд: их общий размер не больше остатка файла
+        const char* q = end;
+        if (!fits<native_char>(p, q, d.path_len))
+            return ReadStatus::corrupt;
+        q -= static_cast<size_t>(d.path_len) * sizeof(native_char);
+        if (!fits<Entry>(p, q, d.entry_count))
+            return ReadStatus::corrupt;
+        q -= static_cast<size_t>(d.entry_count) * sizeof(Entry);
+        if (!fits<native_char>(p, q, d.name_count))
+            return ReadStatus::corrupt;
+        native_string path(d.path_len, native_char());
+        Listing l;
+        l.stamp = d.stamp;
+        l.entries.resize(d.entry_count);
+        l.names.resize(d.name_count);
+        if (!take(p, end, path.data(), path.size()) || !take(p, end, l.entries.data(), l.entries.size()) ||
+            !take(p, end, l.names.data(), l.names.size()))
+            return ReadStatus::corrupt;
+        for (const Entry& e : l.entries) {
+            if (static_cast<uint64_t>(e.off) + e.len > l.names.size())
+                return ReadStatus::corrupt;
+        }
+        loaded.emplace(std::move(path), std::move(l));
+    }
+    dirs.swap(loaded);
+    return ReadStatus::loaded;
+}
+
+std::error_code ListingCache::save(const fs::path& file) {
+    // подкаталоги, пропавшие из перечисленного заново каталога, уходят из кэша вместе с поддеревом:
+    // сами они в этом запуске уже не встретятся
+    std::unordered_set<native_string> gone;
+    for (std::vector<Fresh>& v : fresh) {
+        for (Fresh& f : v) {
+            Listing& slot = dirs[f.dir];
+            if (!slot.entries.empty()) {
+                std::unordered_set<native_view> kept;
+                for (const Entry& e : f.listing.entries) {
+                    if (e.dir)
+                        kept.insert(f.listing.name(e));
+                }
+                for (const Entry& e : slot.entries) {
+                    if (e.dir && !kept.count(slot.name(e))) {
+                        native_string sub = f.dir;
+                        append_component(sub, slot.name(e));
+                        gone.insert(std::move(sub));
+                    }
+                }
+            }
+            slot = std::move(f.listing);
+        }
+        v.clear();
+    }
+    if (!gone.empty()) {
+        for (auto it = dirs.begin(); it != dirs.end();) {
+            // путь или любой из его предков среди пропавших
+            native_view p = it->first;
+            bool drop = false;
+            while (!drop && !p.empty()) {
+                drop = gone.count(native_string(p)) != 0;
+                const size_t sep = p.find_last_of(native_char(fs::path::preferred_separator));
+                p = (sep == native_view::npos) ? native_view() : p.substr(0, sep);
+            }
+            it = drop ? dirs.erase(it) : std::next(it);
+        }
+    }
+
+    // запись во временный файл и замена, чтобы прерванный запуск не оставил обрезанный кэш
+    fs::path tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return std::make_error_code(std::errc::io_error);
+
+        CacheHeader h{};
+        std::memcpy(h.magic, cache_magic, sizeof(cache_magic));
+        h.version = cache_version;
+        h.char_size = sizeof(native_char);
+        h.flags = follow ? flag_follow_links : 0;
+        h.dir_count = dirs.size();
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        for (const auto& [path, l] : dirs) {
+            DirHeader d{};
+            d.stamp = l.stamp;
+            d.path_len = static_cast<uint32_t>(path.size());
+            d.entry_count = static_cast<uint32_t>(l.entries.size());
+            d.name_count = static_cast<uint32_t>(l.names.size());
+            out.write(reinterpret_cast<const char*>(&d), sizeof(d));
+            out.write(reinterpret_cast<const char*>(path.data()), static_cast<std::streamsize>(path.size() * sizeof(native_char)));
+            out.write(reinterpret_cast<const char*>(l.entries.data()), static_cast<std::streamsize>(l.entries.size() * sizeof(Entry)));
+            out.write(reinterpret_cast<const char*>(l.names.data()), static_cast<std::streamsize>(l.names.size() * sizeof(native_char)));
+        }
+        if (!out)
+            return std::make_error_code(std::errc::io_error);
+    }
+    std::error_code ec;
+    fs::rename(tmp, file, ec);
+    return ec;
+}
+
+void ListingCache::prepare(int threads) {
+    fresh.assign(static_cast<size_t>(threads), {});
+    racy_from = stamp_now() - racy_window;
+}
+
+const ListingCache::Listing* ListingCache::find(const native_string& dir, int64_t stamp) const {
+    auto it = dirs.find(dir);
+    return (it != dirs.end() && it->second.stamp == stamp) ? &it->second : nullptr;
+}
+
+void ListingCache::store(int thread, const native_string& dir, Listing&& listing) {
+    if (listing.stamp >= racy_from)
+        return;
+    fresh[static_cast<size_t>(thread)].push_back(Fresh{ dir, std::move(listing) });
+}
+
+bool ListingCache::changed() const {
+    for (const std::vector<Fresh>& v : fresh) {
+        if (!v.empty())
+            return true;
+    }
+    return false;
+}
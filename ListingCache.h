@@ -0,0 +1,87 @@
+﻿#pragma once
+
+// кэш списков каталогов между запусками: для каждого обойдённого каталога хранятся время его
+// последнего изменения и имена записей. Пока время каталога не изменилось, набор имён в нём
+// тот же, и обход сверяет шаблоны с сохранёнными именами, не перечисляя каталог заново.
+// Размер, время и атрибуты файлов не кэшируются: они меняются без изменения каталога и при
+// фильтрах дочитываются только для файлов, совпавших по имени
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "Wildcard.h"
+
+class ListingCache {
+public:
+    // запись каталога: смещение и длина имени в пуле, подкаталог или файл (как их отдал сканер)
+    struct Entry {
+        uint32_t off;
+        uint16_t len;
+        uint16_t dir;
+    };
+
+    // снимок одного каталога
+    struct Listing {
+        int64_t stamp = 0; // время изменения каталога в единицах системы (FILETIME или наносекунды)
+        native_string names;
+        std::vector<Entry> entries;
+
+        void add(native_view name, bool is_dir) {
+            entries.push_back(Entry{ static_cast<uint32_t>(names.size()), static_cast<uint16_t>(name.size()), static_cast<uint16_t>(is_dir) });
+            names.append(name);
+        }
+        native_view name(const Entry& e) const { return native_view(names.data() + e.off, e.len); }
+        void clear() {
+            names.clear();
+            entries.clear();
+        }
+    };
+
+    // follow_links входит в ключ: со ссылками и без них сканер отдаёт разные подкаталоги,
+    // и кэш с другим режимом не читается
+    explicit ListingCache(bool follow_links = false) : follow(follow_links) {}
+
+    // итог чтения; при любом, кроме loaded, кэш пуст и строится заново
+    enum class ReadStatus {
+        loaded,
+        missing,     // файла нет — первый запуск
+        other_mode,  // снят с другим --follow-links
+        corrupt,     // не тот формат, обрезан или повреждён
+    };
+
+    ReadStatus read(const std::filesystem::path& file);
+    // сохраняет прочитанное вместе с новыми снимками; каталоги, не встреченные в этом запуске, остаются
+    std::error_code save(const std::filesystem::path& file);
+
+    // до обхода: по набору новых снимков на поток, чтобы они записывались без блокировок
+    void prepare(int threads);
+
+    // снимок каталога, если время его изменения совпадает с сохранённым; потоки читают одновременно
+    const Listing* find(const native_string& dir, int64_t stamp) const;
+
+    // новый снимок каталога, перечисленного потоком thread. Каталог, изменённый в последние
+    // секунды перед обходом, не запоминается: следующее изменение могло бы прийтись на ту же
+    // отметку времени и остаться незамеченным
+    void store(int thread, const native_string& dir, Listing&& listing);
+
+    bool changed() const;
+    size_t size() const { return dirs.size(); }
+
+    // время изменения каталога; false — его не удалось узнать, и каталог обходится без кэша
+    static bool dir_stamp(const native_string& dir, int64_t& stamp);
+
+private:
+    struct Fresh {
+        native_string dir;
+        Listing listing;
+    };
+
+    bool follow;
+    int64_t racy_from = INT64_MAX; // каталоги с отметкой не раньше этой не запоминаются
+    std::unordered_map<native_string, Listing> dirs;
+    std::vector<std::vector<Fresh>> fresh; // по потоку обхода
+};
@@ -0,0 +1,164 @@
+﻿#pragma once
+
+// асинхронный лог программы и движка поиска; пока logger не открыт, макросы LOG_* ничего не делают
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+inline std::string get_current_time() {
+    auto now = std::chrono::system_clock::now();
+    auto time_t_now = std::chrono::system_clock::to_time_t(now);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+
+    std::tm local_tm;  // структура для локального времени
+    localtime_s(&local_tm, &time_t_now);
+
+    std::ostringstream oss;
+    oss << std::put_time(&local_tm, "%d-%m-%Y %H:%M:%S");
+    oss << '.' << std::setprecision(3) << std::fixed << ms.count();
+    return oss.str();
+}
+
+// уровни логирования; off отключает лог полностью
+enum class LogLevel { off, error, warn, info, debug };
+
+// асинхронный лог: потоки кладут готовые строки в lock-free кольцевой буфер (MPSC),
+// фоновый поток сбрасывает их в файл пачками. Проверка уровня в макросах LOG_* идёт
+// до построения сообщения, поэтому отключённые уровни ничего не стоят
+class Logger {
+public:
+    Logger() : slots(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; ++i)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    ~Logger() { close(); }
+
+    // false, если файл лога не открылся; при уровне off файл не создаётся
+    bool open(const std::string& path, LogLevel lvl) {
+        if (lvl == LogLevel::off)
+            return true;
+        file.open(path, std::ios::out | std::ios::app | std::ios::binary);
+        if (!file.is_open())
+            return false;
+        flusher = std::thread(&Logger::run, this);
+        level.store(lvl);
+        return true;
+    }
+
+    // вызывается после завершения всех пишущих потоков: дописывает очередь и закрывает файл.
+    // Уровень сбрасывается в off до остановки фонового потока, поэтому поздние LOG_* ничего
+    // не кладут в очередь, которую уже никто не разбирает
+    void close() {
+        level.store(LogLevel::off);
+        if (flusher.joinable()) {
+            done.store(true);
+            cv.notify_one();
+            flusher.join();
+        }
+        if (file.is_open())
+            file.close();
+    }
+
+    bool enabled(LogLevel l) const { return l <= level.load(std::memory_order_relaxed); }
+
+    void write(LogLevel l, const std::string& msg) {
+        static const char* const prefixes[] = { "", "[error] ", "[warn] ", "", "[debug] " };
+        push(prefixes[static_cast<int>(l)] + msg);
+    }
+
+    // несколько уже отформатированных строк одним сообщением
+    void write_raw(std::string text) { push(std::move(text)); }
+
+private:
+    static constexpr size_t capacity = 1 << 12;
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        std::string msg;
+    };
+
+    // ограниченная очередь Вьюкова: номер слота говорит, свободен он или занят
+    void push(std::string msg) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & (capacity - 1)];
+            const size_t seq = slot.seq.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.msg = std::move(msg);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    cv.notify_one();
+                    return;
+                }
+            }
+            else if (diff < 0) { // буфер полон: ждём фоновый поток, сообщения не теряем
+                if (done.load()) // ...если он ещё работает; после close() ждать некого
+                    return;
+                std::this_thread::yield();
+                pos = tail.load(std::memory_order_relaxed);
+            }
+            else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(std::string& out) {
+        Slot& slot = slots[head & (capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != head + 1)
+            return false;
+        out = std::move(slot.msg);
+        slot.msg.clear();
+        slot.seq.store(head + capacity, std::memory_order_release);
+        ++head;
+        return true;
+    }
+
+    void run() {
+        std::string msg;
+        while (true) {
+            const bool finishing = done.load();
+            bool wrote = false;
+            while (pop(msg)) {
+                file.write(msg.data(), static_cast<std::streamsize>(msg.size()));
+                file.put('\n');
+                wrote = true;
+            }
+            if (wrote)
+                file.flush();
+            if (finishing)
+                break;
+            std::unique_lock<std::mutex> lk(wait_mtx);
+            cv.wait_for(lk, std::chrono::milliseconds(10));
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    alignas(64) size_t head = 0; // только фоновый поток
+    std::atomic<LogLevel> level{ LogLevel::off };
+    std::ofstream file;
+    std::thread flusher;
+    std::atomic<bool> done{ false };
+    std::mutex wait_mtx; // только для ожидания фонового потока
+    std::condition_variable cv;
+};
+
+inline Logger logger; // общий для программы и FinderEngine; пока его не открыли, уровень off
+
+#define LOG_AT(lvl, msg) do { if (logger.enabled(lvl)) logger.write(lvl, (msg)); } while (0)
+#define LOG_ERROR(msg) LOG_AT(LogLevel::error, msg)
+#define LOG_WARN(msg) LOG_AT(LogLevel::warn, msg)
+#define LOG_INFO(msg) LOG_AT(LogLevel::info, msg)
+#define LOG_DEBUG(msg) LOG_AT(LogLevel::debug, msg)
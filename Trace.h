@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#endif
+
+#include "Wildcard.h"
+
+// события ETW (TraceLogging) для разбора обхода на временной шкале WPA рядом с активностью
+// диска и сети: запись идёт в буферы сеанса ядра без форматирования текста, а без
+// запущенного сеанса каждый вызов — одна проверка флага. GUID провайдера получен из имени
+// тем же хешем, что у EventSource, поэтому в WPR и tracelog его можно включать как *FileFinder.
+// Ключевые слова позволяют включать группы событий по отдельности. Вне Windows вызовы пустые
+namespace trace {
+
+constexpr uint64_t kw_threads = 0x1; // запуск и завершение потоков обхода
+constexpr uint64_t kw_dirs = 0x2;    // начало и конец обработки каталога
+constexpr uint64_t kw_queue = 0x4;   // перехват задач и ожидание работы
+constexpr uint64_t kw_matches = 0x8;
+constexpr uint64_t kw_errors = 0x10; // ошибки перечисления, filesystem_error
+
+#ifdef _WIN32
+TRACELOGGING_DECLARE_PROVIDER(provider); // определён в FinderEngine.cpp
+
+// регистрация провайдера на время жизни объекта, снимается при любом выходе из main
+struct Registration {
+    Registration() { TraceLoggingRegister(provider); }
+    ~Registration() { TraceLoggingUnregister(provider); }
+};
+
+inline bool enabled(uint64_t keyword) { return TraceLoggingProviderEnabled(provider, 0, keyword); }
+
+inline void thread_start(int id) {
+    TraceLoggingWrite(provider, "WorkerThread", TraceLoggingOpcode(WINEVENT_OPCODE_START), TraceLoggingKeyword(kw_threads),
+        TraceLoggingInt32(id, "Worker"));
+}
+
+inline void thread_stop(int id) {
+    TraceLoggingWrite(provider, "WorkerThread", TraceLoggingOpcode(WINEVENT_OPCODE_STOP), TraceLoggingKeyword(kw_threads),
+        TraceLoggingInt32(id, "Worker"));
+}
+
+inline void dir_begin(int id, native_view path, uint32_t depth) {
+    TraceLoggingWrite(provider, "Directory", TraceLoggingOpcode(WINEVENT_OPCODE_START), TraceLoggingKeyword(kw_dirs),
+        TraceLoggingInt32(id, "Worker"), TraceLoggingCountedWideString(path.data(), static_cast<USHORT>(std::min<size_t>(path.size(), USHRT_MAX)), "Path"),
+        TraceLoggingUInt32(depth, "Depth"));
+}
+
+inline void dir_end(int id, uint64_t entries) {
+    TraceLoggingWrite(provider, "Directory", TraceLoggingOpcode(WINEVENT_OPCODE_STOP), TraceLoggingKeyword(kw_dirs),
+        TraceLoggingInt32(id, "Worker"), TraceLoggingUInt64(entries, "Entries"));
+}
+
+inline void steal(int id, int victim) {
+    TraceLoggingWrite(provider, "Steal", TraceLoggingKeyword(kw_queue), TraceLoggingInt32(id, "Worker"), TraceLoggingInt32(victim, "Victim"));
+}
+
+inline void wait(int id, uint64_t ns) {
+    TraceLoggingWrite(provider, "Wait", TraceLoggingKeyword(kw_queue), TraceLoggingInt32(id, "Worker"), TraceLoggingUInt64(ns, "DurationNs"));
+}
+
+inline void match(native_view path, int pattern) {
+    TraceLoggingWrite(provider, "Match", TraceLoggingKeyword(kw_matches),
+        TraceLoggingCountedWideString(path.data(), static_cast<USHORT>(std::min<size_t>(path.size(), USHRT_MAX)), "Path"),
+        TraceLoggingInt32(pattern, "Pattern"));
+}
+
+inline void fs_error(native_view path, const std::error_code& ec, const char* what) {
+    TraceLoggingWrite(provider, "FilesystemError", TraceLoggingLevel(WINEVENT_LEVEL_WARNING), TraceLoggingKeyword(kw_errors),
+        TraceLoggingCountedWideString(path.data(), static_cast<USHORT>(std::min<size_t>(path.size(), USHRT_MAX)), "Path"),
+        TraceLoggingInt32(ec.value(), "Code"), TraceLoggingString(what, "Message"));
+}
+#else
+struct Registration {
+    Registration() {}
+};
+inline bool enabled(uint64_t) { return false; }
+inline void thread_start(int) {}
+inline void thread_stop(int) {}
+inline void dir_begin(int, native_view, uint32_t) {}
+inline void dir_end(int, uint64_t) {}
+inline void steal(int, int) {}
+inline void wait(int, uint64_t) {}
+inline void match(native_view, int) {}
+inline void fs_error(native_view, const std::error_code&, const char*) {}
+#endif
+
+}
@@ -0,0 +1,395 @@
+﻿#include "VolumeIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winioctl.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint64_t frn_mask = 0x0000FFFFFFFFFFFFull;  // младшие 48 бит — номер записи, старшие 16 — последовательность
+constexpr DWORD enum_buffer_size = 1 << 20;            // буфер FSCTL_ENUM_USN_DATA / FSCTL_READ_USN_JOURNAL, 1 МиБ
+constexpr size_t max_path_depth = 4096;                // защита от циклов в повреждённых цепочках родителей
+constexpr char index_magic[8] = { 'F', 'F', 'I', 'N', 'D', 'E', 'X', '1' };
+constexpr uint32_t index_version = 1;
+
+std::error_code last_error() {
+    return std::error_code(static_cast<int>(GetLastError()), std::system_category());
+}
+
+struct HandleCloser {
+    HANDLE h;
+    ~HandleCloser() { if (h != INVALID_HANDLE_VALUE) CloseHandle(h); }
+};
+
+bool valid_header(const IndexHeader& h) {
+    return std::memcmp(h.magic, index_magic, sizeof(index_magic)) == 0 && h.version == index_version;
+}
+
+// счётчики заголовка против размера файла; счётчики взяты из файла, поэтому сравнение
+// идёт делением, без умножения, которое могло бы переполниться
+bool valid_sizes(const IndexHeader& h, uint64_t file_size) {
+    if (file_size < sizeof(IndexHeader))
+        return false;
+    const uint64_t body = file_size - sizeof(IndexHeader);
+    if (h.record_count > body / sizeof(VolumeRecord))
+        return false;
+    return h.name_count <= (body - h.record_count * sizeof(VolumeRecord)) / sizeof(wchar_t);
+}
+
+// имя каждой записи лежит внутри пула: IndexView::name границ не проверяет
+bool valid_records(const VolumeRecord* recs, uint64_t count, uint64_t name_count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        if (static_cast<uint64_t>(recs[i].name_off) + recs[i].name_len > name_count)
+            return false;
+    }
+    return true;
+}
+
+// вызывает f(const USN_RECORD_V2&) для каждой записи ответа FSCTL_ENUM_USN_DATA / FSCTL_READ_USN_JOURNAL;
+// первые 8 байт ответа — позиция, с которой продолжать
+template <class F>
+void for_each_usn_record(const BYTE* base, DWORD got, F&& f) {
+    for (const BYTE* p = base + sizeof(USN); p < base + got;) {
+        const auto* r = reinterpret_cast<const USN_RECORD_V2*>(p);
+        if (r->MajorVersion == 2)
+            f(*r);
+        p += r->RecordLength;
+    }
+}
+
+std::wstring_view record_name(const USN_RECORD_V2& r) {
+    return std::wstring_view(reinterpret_cast<const WCHAR*>(reinterpret_cast<const BYTE*>(&r) + r.FileNameOffset),
+        r.FileNameLength / sizeof(WCHAR));
+}
+
+void sort_by_frn(std::vector<VolumeRecord>& recs) {
+    std::sort(recs.begin(), recs.end(), [](const VolumeRecord& a, const VolumeRecord& b) { return a.frn < b.frn; });
+}
+
+}
+
+std::wstring volume_device_path(const std::wstring& path) {
+    std::error_code ec;
+    fs::path abs = fs::absolute(path, ec);
+    if (ec)
+        return {};
+    std::wstring drive = abs.root_name().native(); // "C:" или "\\server\share"
+    if (drive.size() != 2 || drive[1] != L':')
+        return {};
+    return L"\\\\.\\" + drive;
+}
+
+std::error_code volume_serial(const std::wstring& path, uint32_t& serial) {
+    const std::wstring device = volume_device_path(path);
+    if (device.empty())
+        return std::make_error_code(std::errc::not_supported);
+    const std::wstring root = device.substr(4) + L"\\"; // "C:\"
+    DWORD s = 0;
+    if (!GetVolumeInformationW(root.c_str(), nullptr, 0, &s, nullptr, nullptr, nullptr, 0))
+        return last_error();
+    serial = s;
+    return {};
+}
+
+std::error_code file_reference(const std::wstring& path, uint64_t& frn) {
+    HandleCloser fh{ CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr) };
+    if (fh.h == INVALID_HANDLE_VALUE)
+        return last_error();
+
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(fh.h, &info))
+        return last_error();
+    frn = ((static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow) & frn_mask;
+    return {};
+}
+
+const VolumeRecord* IndexView::find(uint64_t frn) const {
+    const VolumeRecord* it = std::lower_bound(begin(), end(), frn,
+        [](const VolumeRecord& r, uint64_t key) { return r.frn < key; });
+    return (it != end() && it->frn == frn) ? it : nullptr;
+}
+
+bool IndexView::relative_path(const VolumeRecord& r, uint64_t base_frn, std::wstring& out) const {
+    std::vector<const VolumeRecord*> chain;
+    const VolumeRecord* cur = &r;
+    while (true) {
+        if (chain.size() == max_path_depth)
+            return false;
+        chain.push_back(cur);
+        if (cur->parent == base_frn)
+            break;
+        cur = find(cur->parent);
+        if (!cur) // дошли до корня тома или до служебной записи: base_frn не встретился
+            return false;
+    }
+
+    out.clear();
+    for (size_t i = chain.size(); i-- > 0;) {
+        if (!out.empty())
+            out += L'\\';
+        out += name(*chain[i]);
+    }
+    return true;
+}
+
+std::error_code VolumeIndex::load(const std::wstring& path) {
+    recs.clear();
+    names.clear();
+    info = IndexHeader{};
+    std::memcpy(info.magic, index_magic, sizeof(index_magic));
+    info.version = index_version;
+
+    const std::wstring device = volume_device_path(path);
+    if (device.empty())
+        return std::make_error_code(std::errc::not_supported);
+    device.copy(info.device, std::size(info.device) - 1);
+
+    const std::wstring root = device.substr(4) + L"\\"; // "C:\"
+    wchar_t fs_name[MAX_PATH + 1] = {};
+    DWORD serial = 0;
+    if (!GetVolumeInformationW(root.c_str(), nullptr, 0, &serial, nullptr, nullptr, fs_name, MAX_PATH + 1))
+        return last_error();
+    if (std::wstring_view(fs_name) != L"NTFS")
+        return std::make_error_code(std::errc::not_supported);
+    info.volume_serial = serial;
+
+    HandleCloser vol{ CreateFileW(device.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, 0, nullptr) };
+    if (vol.h == INVALID_HANDLE_VALUE)
+        return last_error();
+
+    // верхняя граница USN: без журнала перечисляем всё, но и догружать изменения потом будет не из чего
+    USN_JOURNAL_DATA_V0 journal{};
+    DWORD got = 0;
+    USN high_usn = MAXLONGLONG;
+    if (DeviceIoControl(vol.h, FSCTL_QUERY_USN_JOURNAL, nullptr, 0, &journal, sizeof(journal), &got, nullptr)) {
+        high_usn = journal.NextUsn;
+        info.journal_id = journal.UsnJournalID;
+        info.next_usn = journal.NextUsn;
+    }
+
+    MFT_ENUM_DATA_V0 med{};
+    med.StartFileReferenceNumber = 0;
+    med.LowUsn = 0;
+    med.HighUsn = high_usn;
+
+    std::vector<ULONGLONG> buffer(enum_buffer_size / sizeof(ULONGLONG));
+    const BYTE* base = reinterpret_cast<const BYTE*>(buffer.data());
+
+    while (true) {
+        if (!DeviceIoControl(vol.h, FSCTL_ENUM_USN_DATA, &med, sizeof(med), buffer.data(), enum_buffer_size, &got, nullptr)) {
+            DWORD err = GetLastError();
+            if (err == ERROR_HANDLE_EOF)
+                break;
+            return std::error_code(static_cast<int>(err), std::system_category());
+        }
+        if (got <= sizeof(USN))
+            break;
+
+        for_each_usn_record(base, got, [&](const USN_RECORD_V2& r) {
+            std::wstring_view name = record_name(r);
+            VolumeRecord rec{};
+            rec.frn = r.FileReferenceNumber & frn_mask;
+            rec.parent = r.ParentFileReferenceNumber & frn_mask;
+            rec.name_off = static_cast<uint32_t>(names.size());
+            rec.name_len = static_cast<uint16_t>(name.size());
+            rec.attrs = r.FileAttributes;
+            names.insert(names.end(), name.begin(), name.end());
+            recs.push_back(rec);
+        });
+        med.StartFileReferenceNumber = *reinterpret_cast<const DWORDLONG*>(base);
+    }
+
+    sort_by_frn(recs);
+    return {};
+}
+
+std::error_code VolumeIndex::refresh() {
+    if (info.journal_id == 0)
+        return std::make_error_code(std::errc::not_supported);
+
+    HandleCloser vol{ CreateFileW(info.device, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, 0, nullptr) };
+    if (vol.h == INVALID_HANDLE_VALUE)
+        return last_error();
+
+    USN_JOURNAL_DATA_V0 journal{};
+    DWORD got = 0;
+    if (!DeviceIoControl(vol.h, FSCTL_QUERY_USN_JOURNAL, nullptr, 0, &journal, sizeof(journal), &got, nullptr))
+        return last_error();
+    if (journal.UsnJournalID != info.journal_id || info.next_usn < journal.FirstUsn)
+        return std::error_code(ERROR_JOURNAL_ENTRY_DELETED, std::system_category());
+
+    // последнее известное состояние каждой изменившейся записи
+    struct Change {
+        uint64_t parent;
+        uint32_t attrs;
+        bool deleted;
+        std::wstring name;
+    };
+    std::unordered_map<uint64_t, Change> changes;
+
+    READ_USN_JOURNAL_DATA_V0 rd{};
+    rd.StartUsn = info.next_usn;
+    rd.ReasonMask = 0xFFFFFFFF;
+    rd.ReturnOnlyOnClose = FALSE;
+    rd.Timeout = 0;
+    rd.BytesToWaitFor = 0;
+    rd.UsnJournalID = info.journal_id;
+
+    std::vector<ULONGLONG> buffer(enum_buffer_size / sizeof(ULONGLONG));
+    const BYTE* base = reinterpret_cast<const BYTE*>(buffer.data());
+
+    while (rd.StartUsn < journal.NextUsn) {
+        if (!DeviceIoControl(vol.h, FSCTL_READ_USN_JOURNAL, &rd, sizeof(rd), buffer.data(), enum_buffer_size, &got, nullptr))
+            return last_error();
+        if (got <= sizeof(USN))
+            break;
+
+        for_each_usn_record(base, got, [&](const USN_RECORD_V2& r) {
+            const uint64_t frn = r.FileReferenceNumber & frn_mask;
+            if (r.Reason & USN_REASON_FILE_DELETE)
+                changes[frn] = Change{ 0, 0, true, {} };
+            else if (!(r.Reason & USN_REASON_RENAME_OLD_NAME)) // у старого имени при переименовании нет нового состояния
+                changes[frn] = Change{ r.ParentFileReferenceNumber & frn_mask, r.FileAttributes, false, std::wstring(record_name(r)) };
+        });
+        rd.StartUsn = *reinterpret_cast<const USN*>(base);
+    }
+    info.next_usn = rd.StartUsn;
+
+    if (changes.empty())
+        return {};
+
+    // пересборка массивов: незатронутые записи копируются как есть, изменённые добавляются заново
+    std::vector<VolumeRecord> new_recs;
+    std::vector<wchar_t> new_names;
+    new_recs.reserve(recs.size() + changes.size());
+    new_names.reserve(names.size());
+    auto append = [&](VolumeRecord rec, std::wstring_view name) {
+        rec.name_off = static_cast<uint32_t>(new_names.size());
+        rec.name_len = static_cast<uint16_t>(name.size());
+        new_names.insert(new_names.end(), name.begin(), name.end());
+        new_recs.push_back(rec);
+    };
+
+    const IndexView old = view();
+    for (const VolumeRecord& r : recs) {
+        if (changes.find(r.frn) == changes.end())
+            append(r, old.name(r));
+    }
+    for (const auto& [frn, c] : changes) {
+        if (c.deleted)
+            continue;
+        VolumeRecord rec{};
+        rec.frn = frn;
+        rec.parent = c.parent;
+        rec.attrs = c.attrs;
+        append(rec, c.name);
+    }
+
+    sort_by_frn(new_recs);
+    recs.swap(new_recs);
+    names.swap(new_names);
+    return {};
+}
+
+std::error_code VolumeIndex::save(const std::wstring& file) const {
+    // запись во временный файл и атомарная замена, чтобы не испортить индекс, открытый другим процессом
+    const std::wstring tmp = file + L".tmp";
+    {
+        std::ofstream out(fs::path(tmp), std::ios::binary | std::ios::trunc);
+        if (!out)
+            return std::make_error_code(std::errc::io_error);
+
+        IndexHeader h = info;
+        h.record_count = recs.size();
+        h.name_count = names.size();
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(recs.data()), static_cast<std::streamsize>(recs.size() * sizeof(VolumeRecord)));
+        out.write(reinterpret_cast<const char*>(names.data()), static_cast<std::streamsize>(names.size() * sizeof(wchar_t)));
+        if (!out)
+            return std::make_error_code(std::errc::io_error);
+    }
+    if (!MoveFileExW(tmp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING))
+        return last_error();
+    return {};
+}
+
+std::error_code VolumeIndex::read(const std::wstring& file) {
+    std::ifstream in(fs::path(file), std::ios::binary);
+    if (!in)
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+
+    std::error_code ec;
+    const uint64_t file_size = fs::file_size(fs::path(file), ec);
+    IndexHeader h{};
+    if (ec || !in.read(reinterpret_cast<char*>(&h), sizeof(h)) || !valid_header(h) || !valid_sizes(h, file_size))
+        return std::make_error_code(std::errc::invalid_argument);
+
+    std::vector<VolumeRecord> r(static_cast<size_t>(h.record_count));
+    std::vector<wchar_t> n(static_cast<size_t>(h.name_count));
+    in.read(reinterpret_cast<char*>(r.data()), static_cast<std::streamsize>(r.size() * sizeof(VolumeRecord)));
+    in.read(reinterpret_cast<char*>(n.data()), static_cast<std::streamsize>(n.size() * sizeof(wchar_t)));
+    if (!in || !valid_records(r.data(), r.size(), n.size()))
+        return std::make_error_code(std::errc::invalid_argument);
+
+    info = h;
+    recs.swap(r);
+    names.swap(n);
+    return {};
+}
+
+MappedIndex::~MappedIndex() {
+    if (base)
+        UnmapViewOfFile(base);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file && file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+}
+
+std::error_code MappedIndex::open(const std::wstring& path) {
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return last_error();
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size))
+        return last_error();
+    if (static_cast<uint64_t>(size.QuadPart) < sizeof(IndexHeader))
+        return std::make_error_code(std::errc::invalid_argument);
+
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+        return last_error();
+    base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!base)
+        return last_error();
+
+    // проверка один раз при открытии: дальше пути читаются из отображения без проверок
+    const IndexHeader& h = header();
+    if (!valid_header(h) || !valid_sizes(h, static_cast<uint64_t>(size.QuadPart)))
+        return std::make_error_code(std::errc::invalid_argument);
+    const auto* recs = reinterpret_cast<const VolumeRecord*>(static_cast<const char*>(base) + sizeof(IndexHeader));
+    if (!valid_records(recs, h.record_count, h.name_count))
+        return std::make_error_code(std::errc::invalid_argument);
+    return {};
+}
+
+IndexView MappedIndex::view() const {
+    const IndexHeader& h = header();
+    const auto* recs = reinterpret_cast<const VolumeRecord*>(static_cast<const char*>(base) + sizeof(IndexHeader));
+    const auto* names = reinterpret_cast<const wchar_t*>(recs + h.record_count);
+    return IndexView(recs, static_cast<size_t>(h.record_count), names);
+}
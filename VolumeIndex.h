@@ -0,0 +1,114 @@
+﻿#pragma once
+
+// плоский индекс тома NTFS, прочитанный прямо из MFT (FSCTL_ENUM_USN_DATA),
+// с сохранением в файл и догрузкой изменений из журнала USN.
+//
+// Отдельной таблицы каталогов нет: каталоги — такие же записи, массив отсортирован по frn, и цепочка
+// родителей собирается двоичным поиском по нему (IndexView::find). Каждое имя хранится в пуле один раз.
+// У записи один родитель — тот, что отдаёт FSCTL_ENUM_USN_DATA, — поэтому файл с несколькими жёсткими
+// ссылками находится только по одному из своих путей
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// одна запись MFT: файл или каталог
+struct VolumeRecord {
+    uint64_t frn;       // номер записи MFT без номера последовательности
+    uint64_t parent;    // номер записи родительского каталога; у жёстких ссылок — только одного из них
+    uint32_t name_off;  // смещение имени в пуле имён (в wchar_t)
+    uint32_t attrs;     // FILE_ATTRIBUTE_*
+    uint16_t name_len;  // длина имени в wchar_t
+    uint16_t reserved;
+};
+
+// заголовок файла индекса; за ним идут record_count записей VolumeRecord и name_count символов пула имён
+struct IndexHeader {
+    char magic[8];           // "FFINDEX1"
+    uint32_t version;
+    uint32_t volume_serial;
+    uint64_t journal_id;     // 0 — журнал USN на томе не ведётся
+    int64_t next_usn;        // первый USN, ещё не учтённый в индексе
+    uint64_t record_count;
+    uint64_t name_count;
+    wchar_t device[8];       // \\.\C:
+};
+
+// доступ только на чтение к отсортированному массиву записей и пулу имён
+class IndexView {
+public:
+    IndexView() = default;
+    IndexView(const VolumeRecord* recs, size_t count, const wchar_t* names)
+        : recs(recs), count(count), names(names) {}
+
+    const VolumeRecord* begin() const { return recs; }
+    const VolumeRecord* end() const { return recs + count; }
+    size_t size() const { return count; }
+
+    std::wstring_view name(const VolumeRecord& r) const {
+        return std::wstring_view(names + r.name_off, r.name_len);
+    }
+
+    // запись по номеру MFT или nullptr
+    const VolumeRecord* find(uint64_t frn) const;
+
+    // путь записи относительно каталога base_frn (без ведущего разделителя);
+    // false, если запись лежит не внутри base_frn
+    bool relative_path(const VolumeRecord& r, uint64_t base_frn, std::wstring& out) const;
+
+private:
+    const VolumeRecord* recs = nullptr;
+    size_t count = 0;
+    const wchar_t* names = nullptr;
+};
+
+class VolumeIndex {
+public:
+    // чтение всех записей MFT тома, которому принадлежит path (нужны права администратора)
+    std::error_code load(const std::wstring& path);
+
+    // применение изменений из журнала USN начиная с next_usn; ошибка означает,
+    // что журнал пересоздан или уже затёр нужные записи, и индекс надо строить заново
+    std::error_code refresh();
+
+    std::error_code save(const std::wstring& file) const;
+    std::error_code read(const std::wstring& file);
+
+    IndexView view() const { return IndexView(recs.data(), recs.size(), names.data()); }
+    const IndexHeader& header() const { return info; }
+
+private:
+    IndexHeader info{};
+    std::vector<VolumeRecord> recs;  // отсортированы по frn
+    std::vector<wchar_t> names;
+};
+
+// индекс, отображённый в память из файла без копирования
+class MappedIndex {
+public:
+    MappedIndex() = default;
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+    ~MappedIndex();
+
+    std::error_code open(const std::wstring& file);
+
+    IndexView view() const;
+    const IndexHeader& header() const { return *static_cast<const IndexHeader*>(base); }
+
+private:
+    void* file = nullptr;
+    void* mapping = nullptr;
+    const void* base = nullptr;
+};
+
+// номер записи MFT для существующего файла или каталога
+std::error_code file_reference(const std::wstring& path, uint64_t& frn);
+
+// имя устройства тома вида \\.\C: для пути на локальном диске; пустая строка, если путь не на букве диска
+std::wstring volume_device_path(const std::wstring& path);
+
+// серийный номер тома, на котором лежит path
+std::error_code volume_serial(const std::wstring& path, uint32_t& serial);
@@ -0,0 +1,636 @@
+﻿#pragma once
+
+// сопоставление имён файлов с шаблонами: matchWildcard, разобранный шаблон CompiledPattern,
+// набор шаблонов PatternSet и векторные примитивы сравнения, на которых они построены.
+// Вынесено из FileFinder.cpp, чтобы микробенчмарки собирали тот же код, что и программа
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cwctype>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FF_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define FF_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define FF_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using native_char = std::filesystem::path::value_type;  // wchar_t в Windows, char в остальных системах
+using native_string = std::filesystem::path::string_type;
+using native_view = std::basic_string_view<native_char>;
+
+inline char fold_char(char c) {
+    const unsigned char u = static_cast<unsigned char>(c);
+    if (u < 0x80) // ASCII без обращения к таблицам локали, как и у wchar_t
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+    return static_cast<char>(std::tolower(u));
+}
+
+inline wchar_t fold_char(wchar_t c) {
+    if (c < 0x80) // ASCII без обращения к таблицам локали
+        return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c + (L'a' - L'A')) : c;
+    return static_cast<wchar_t>(std::towlower(c));
+}
+
+// сопоставление имени файла с шаблоном
+template <class CharT>
+bool matchWildcard(std::basic_string_view<CharT> name, std::basic_string_view<CharT> pattern) {
+    const size_t npos = std::basic_string_view<CharT>::npos;
+    size_t n = 0, p = 0;
+    size_t star = npos, match = 0;
+
+    while (n < name.size()) {
+        if (p < pattern.size() &&
+            (pattern[p] == CharT('?') || fold_char(pattern[p]) == fold_char(name[n]))) {
+            ++n;
+            ++p;
+        }
+        else if (p < pattern.size() && pattern[p] == CharT('*')) {
+            star = p++;
+            match = n;
+        }
+        else if (star != npos) {
+            p = star + 1;
+            n = ++match;
+        }
+        else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == CharT('*'))
+        ++p;
+
+    return p == pattern.size();
+}
+
+// векторное сравнение имён с ASCII-литералом без учёта регистра: SSE2 всегда, AVX2 — если его
+// поддерживают процессор и ОС (проверяется один раз при запуске). Литерал передаётся уже в нижнем
+// регистре; у имени регистр сводится только в пределах ASCII, поэтому вызывающий код выбирает
+// эти функции лишь для литералов из ASCII без '?'. Немногие символы вне ASCII, которые fold_char
+// сводит к букве литерала (folds_to_ascii), вызывающий код ищет в сравниваемой части имени сам и
+// с ними уходит на скалярный путь. Векторные версии есть для 8- и 16-битных символов
+namespace simd {
+
+template <class CharT>
+inline CharT fold_ascii(CharT c) {
+    return (c >= CharT('A') && c <= CharT('Z')) ? static_cast<CharT>(c + ('a' - 'A')) : c;
+}
+
+template <class CharT>
+bool equal_fold_scalar(const CharT* s, const CharT* lit, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (fold_ascii(s[i]) != lit[i])
+            return false;
+    }
+    return true;
+}
+
+template <class CharT>
+bool contains_fold_scalar(const CharT* h, size_t n, const CharT* needle, size_t m) {
+    for (size_t i = 0; i + m <= n; ++i) {
+        if (equal_fold_scalar(h + i, needle, m))
+            return true;
+    }
+    return false;
+}
+
+#ifdef FF_X86_SIMD
+
+inline unsigned lowest_bit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return static_cast<unsigned>(i);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// 0 — только SSE2, 2 — AVX2
+inline int detect_level() {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7)
+        return 0;
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) // ОС сохраняет регистры YMM
+        return 0;
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) ? 2 : 0;
+#else
+    return __builtin_cpu_supports("avx2") ? 2 : 0;
+#endif
+}
+
+inline const int level = detect_level();
+
+template <class CharT>
+inline __m128i set1_128(CharT c) {
+    if constexpr (sizeof(CharT) == 1) return _mm_set1_epi8(static_cast<char>(c));
+    else return _mm_set1_epi16(static_cast<short>(c));
+}
+
+template <class CharT>
+inline __m128i cmpeq_128(__m128i a, __m128i b) {
+    if constexpr (sizeof(CharT) == 1) return _mm_cmpeq_epi8(a, b);
+    else return _mm_cmpeq_epi16(a, b);
+}
+
+// 'A'..'Z' -> 'a'..'z'; байты/слова со старшим битом знаковое сравнение в диапазон не пропускает
+template <class CharT>
+inline __m128i fold_128(__m128i v) {
+    __m128i upper;
+    if constexpr (sizeof(CharT) == 1)
+        upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    else
+        upper = _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16('A' - 1)), _mm_cmplt_epi16(v, _mm_set1_epi16('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, set1_128<CharT>(CharT(0x20))));
+}
+
+template <class CharT>
+inline __m128i load_128(const CharT* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+template <class CharT>
+bool equal_fold_sse2(const CharT* s, const CharT* lit, size_t n) {
+    constexpr size_t lanes = 16 / sizeof(CharT);
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(fold_128<CharT>(load_128(s + i)), load_128(lit + i))) != 0xFFFF)
+            return false;
+    }
+    return equal_fold_scalar(s + i, lit + i, n - i);
+}
+
+// фильтр по первому и последнему символу иглы, как в быстрых реализациях memmem:
+// полное сравнение только для позиций, где совпали оба
+template <class CharT>
+bool contains_fold_sse2(const CharT* h, size_t n, const CharT* needle, size_t m) {
+    constexpr size_t lanes = 16 / sizeof(CharT);
+    constexpr unsigned lane_bits = (1u << sizeof(CharT)) - 1;
+    const __m128i first = set1_128(needle[0]);
+    const __m128i last = set1_128(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + lanes <= n; i += lanes) {
+        const __m128i eq = _mm_and_si128(cmpeq_128<CharT>(fold_128<CharT>(load_128(h + i)), first),
+            cmpeq_128<CharT>(fold_128<CharT>(load_128(h + i + m - 1)), last));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+        while (mask) {
+            const unsigned bit = lowest_bit(mask);
+            if (equal_fold_scalar(h + i + bit / sizeof(CharT), needle, m))
+                return true;
+            mask &= ~(lane_bits << bit);
+        }
+    }
+    return contains_fold_scalar(h + i, n - i, needle, m);
+}
+
+// сравнение не длиннее одного регистра: p указывает на 16 байт имени, padded — литерал,
+// дополненный до 16 байт произвольными символами; учитываются только символы из care
+template <class CharT>
+inline bool masked_equal_sse2(const CharT* p, const CharT* padded, unsigned care) {
+    const unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(fold_128<CharT>(load_128(p)), load_128(padded))));
+    return (eq & care) == care;
+}
+
+template <class CharT>
+FF_TARGET_AVX2 inline __m256i set1_256(CharT c) {
+    if constexpr (sizeof(CharT) == 1) return _mm256_set1_epi8(static_cast<char>(c));
+    else return _mm256_set1_epi16(static_cast<short>(c));
+}
+
+template <class CharT>
+FF_TARGET_AVX2 inline __m256i cmpeq_256(__m256i a, __m256i b) {
+    if constexpr (sizeof(CharT) == 1) return _mm256_cmpeq_epi8(a, b);
+    else return _mm256_cmpeq_epi16(a, b);
+}
+
+template <class CharT>
+FF_TARGET_AVX2 inline __m256i fold_256(__m256i v) {
+    __m256i upper;
+    if constexpr (sizeof(CharT) == 1)
+        upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    else
+        upper = _mm256_and_si256(_mm256_cmpgt_epi16(v, _mm256_set1_epi16('A' - 1)), _mm256_cmpgt_epi16(_mm256_set1_epi16('Z' + 1), v));
+    return _mm256_or_si256(v, _mm256_and_si256(upper, set1_256<CharT>(CharT(0x20))));
+}
+
+template <class CharT>
+FF_TARGET_AVX2 inline __m256i load_256(const CharT* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+template <class CharT>
+FF_TARGET_AVX2 bool equal_fold_avx2(const CharT* s, const CharT* lit, size_t n) {
+    constexpr size_t lanes = 32 / sizeof(CharT);
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        if (static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(fold_256<CharT>(load_256(s + i)), load_256(lit + i)))) != 0xFFFFFFFFu)
+            return false;
+    }
+    return equal_fold_sse2(s + i, lit + i, n - i);
+}
+
+template <class CharT>
+FF_TARGET_AVX2 bool contains_fold_avx2(const CharT* h, size_t n, const CharT* needle, size_t m) {
+    constexpr size_t lanes = 32 / sizeof(CharT);
+    constexpr unsigned lane_bits = (1u << sizeof(CharT)) - 1;
+    const __m256i first = set1_256(needle[0]);
+    const __m256i last = set1_256(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + lanes <= n; i += lanes) {
+        const __m256i eq = _mm256_and_si256(cmpeq_256<CharT>(fold_256<CharT>(load_256(h + i)), first),
+            cmpeq_256<CharT>(fold_256<CharT>(load_256(h + i + m - 1)), last));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+        while (mask) {
+            const unsigned bit = lowest_bit(mask);
+            if (equal_fold_scalar(h + i + bit / sizeof(CharT), needle, m))
+                return true;
+            mask &= ~(lane_bits << bit);
+        }
+    }
+    return contains_fold_sse2(h + i, n - i, needle, m);
+}
+
+// точный поиск байтов (содержимое файлов): тот же фильтр по краям иглы, но без приведения регистра
+inline bool contains_bytes_sse2(const char* h, size_t n, const char* needle, size_t m) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(load_128(h + i), first), _mm_cmpeq_epi8(load_128(h + i + m - 1), last));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+        while (mask) {
+            const unsigned bit = lowest_bit(mask);
+            if (std::memcmp(h + i + bit, needle, m) == 0)
+                return true;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view(h + i, n - i).find(std::string_view(needle, m)) != std::string_view::npos;
+}
+
+FF_TARGET_AVX2 inline bool contains_bytes_avx2(const char* h, size_t n, const char* needle, size_t m) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(load_256(h + i), first), _mm256_cmpeq_epi8(load_256(h + i + m - 1), last));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+        while (mask) {
+            const unsigned bit = lowest_bit(mask);
+            if (std::memcmp(h + i + bit, needle, m) == 0)
+                return true;
+            mask &= mask - 1;
+        }
+    }
+    return contains_bytes_sse2(h + i, n - i, needle, m);
+}
+
+#endif // FF_X86_SIMD
+
+// символов в 16-байтном регистре для данного типа символа
+template <class CharT>
+constexpr size_t lanes_128 = 16 / sizeof(CharT);
+
+template <class CharT>
+constexpr bool vectorizable = sizeof(CharT) <= 2;
+
+template <class CharT>
+bool equal_fold(const CharT* s, const CharT* lit, size_t n) {
+#ifdef FF_X86_SIMD
+    if constexpr (vectorizable<CharT>)
+        return level >= 2 ? equal_fold_avx2(s, lit, n) : equal_fold_sse2(s, lit, n);
+#endif
+    return equal_fold_scalar(s, lit, n);
+}
+
+// символы вне ASCII, которые fold_char сводит к ASCII (знак кельвина — к 'k'); зависят от локали,
+// поэтому собираются один раз при первом разборе шаблона, уже после setlocale
+template <class CharT>
+const std::basic_string<CharT>& folds_to_ascii() {
+    static const std::basic_string<CharT> chars = [] {
+        std::basic_string<CharT> out;
+        const unsigned long top = sizeof(CharT) == 1 ? 0xFF : 0xFFFF; // выше BMP таких символов нет
+        for (unsigned long c = 0x80; c <= top; ++c) {
+            if (static_cast<unsigned long>(fold_char(static_cast<CharT>(c))) < 0x80)
+                out.push_back(static_cast<CharT>(c));
+        }
+        return out;
+    }();
+    return chars;
+}
+
+template <class CharT>
+bool contains_fold(const CharT* h, size_t n, const CharT* needle, size_t m) {
+    if (m == 0)
+        return true;
+    if (m > n)
+        return false;
+#ifdef FF_X86_SIMD
+    if constexpr (vectorizable<CharT>)
+        return level >= 2 ? contains_fold_avx2(h, n, needle, m) : contains_fold_sse2(h, n, needle, m);
+#endif
+    return contains_fold_scalar(h, n, needle, m);
+}
+
+inline bool contains_bytes(const char* h, size_t n, const char* needle, size_t m) {
+    if (m == 0)
+        return true;
+    if (m > n)
+        return false;
+#ifdef FF_X86_SIMD
+    return level >= 2 ? contains_bytes_avx2(h, n, needle, m) : contains_bytes_sse2(h, n, needle, m);
+#else
+    return std::string_view(h, n).find(std::string_view(needle, m)) != std::string_view::npos;
+#endif
+}
+
+// короткий литерал (не длиннее регистра) в начале или в конце имени одним сравнением;
+// padded — литерал, выровненный в 16-байтном буфере по нужному краю
+template <class CharT>
+bool prefix_fold_short(const CharT* name, size_t n, const CharT* padded, size_t m) {
+#ifdef FF_X86_SIMD
+    if constexpr (vectorizable<CharT>) {
+        if (n >= lanes_128<CharT>)
+            return masked_equal_sse2(name, padded, (1u << (m * sizeof(CharT))) - 1);
+    }
+#endif
+    return n >= m && equal_fold_scalar(name, padded, m);
+}
+
+template <class CharT>
+bool suffix_fold_short(const CharT* name, size_t n, const CharT* padded, size_t m) {
+    constexpr size_t lanes = lanes_128<CharT>;
+#ifdef FF_X86_SIMD
+    if constexpr (vectorizable<CharT>) {
+        if (n >= lanes)
+            return masked_equal_sse2(name + n - lanes, padded, 0xFFFFu & ~((1u << ((lanes - m) * sizeof(CharT))) - 1));
+    }
+#endif
+    return n >= m && equal_fold_scalar(name + n - m, padded + lanes - m, m);
+}
+
+}
+
+// шаблон, разобранный один раз при запуске: для типичных форм (*.log, prefix*, *mid*, точное имя)
+// выбирается прямое сравнение без перебора с возвратами, для остальных — перебор по шаблону,
+// заранее приведённому к нижнему регистру
+template <class CharT>
+class CompiledPattern {
+public:
+    using view = std::basic_string_view<CharT>;
+    using string = std::basic_string<CharT>;
+
+    enum class Kind { exact, prefix, suffix, contains, any, general };
+
+    CompiledPattern() = default;
+
+    explicit CompiledPattern(view pattern) {
+        // подряд идущие '*' эквивалентны одной
+        for (CharT c : pattern) {
+            if (c == CharT('*') && !folded.empty() && folded.back() == CharT('*'))
+                continue;
+            folded.push_back(c == CharT('?') ? c : fold_char(c));
+        }
+
+        const size_t stars = static_cast<size_t>(std::count(folded.begin(), folded.end(), CharT('*')));
+        const size_t n = folded.size();
+        if (stars == 0) {
+            k = Kind::exact;
+            lit = folded;
+        }
+        else if (n == 1) {
+            k = Kind::any;
+        }
+        else if (stars == 1 && folded.back() == CharT('*')) {
+            k = Kind::prefix;
+            lit = folded.substr(0, n - 1);
+        }
+        else if (stars == 1 && folded.front() == CharT('*')) {
+            k = Kind::suffix;
+            lit = folded.substr(1);
+        }
+        else if (stars == 2 && folded.front() == CharT('*') && folded.back() == CharT('*')) {
+            k = Kind::contains;
+            lit = folded.substr(1, n - 2);
+        }
+        else {
+            k = Kind::general;
+        }
+
+        // литерал из ASCII без '?' сравнивается векторными функциями
+        simd_lit = !lit.empty() && std::all_of(lit.begin(), lit.end(),
+            [](CharT c) { return c != CharT('?') && static_cast<unsigned long>(c) < 0x80; });
+        constexpr size_t lanes = simd::lanes_128<CharT>;
+        if (simd_lit) {
+            for (CharT c : simd::folds_to_ascii<CharT>()) {
+                if (lit.find(fold_char(c)) != string::npos)
+                    folding.push_back(c);
+            }
+        }
+        if (simd_lit && lit.size() <= lanes) {
+            std::fill(std::begin(head), std::end(head), CharT(0));
+            std::fill(std::begin(tail), std::end(tail), CharT(0));
+            std::copy(lit.begin(), lit.end(), head);
+            std::copy(lit.begin(), lit.end(), tail + lanes - lit.size());
+            short_lit = true;
+        }
+    }
+
+    bool match(view name) const {
+        if (simd_lit && (folding.empty() || !has_folding(name)))
+            return match_simd(name);
+        switch (k) {
+        case Kind::exact:
+            return name.size() == lit.size() && equal_folded(name.data(), lit.data(), lit.size());
+        case Kind::prefix:
+            return name.size() >= lit.size() && equal_folded(name.data(), lit.data(), lit.size());
+        case Kind::suffix:
+            return name.size() >= lit.size() && equal_folded(name.data() + name.size() - lit.size(), lit.data(), lit.size());
+        case Kind::contains:
+            for (size_t i = 0; i + lit.size() <= name.size(); ++i) {
+                if (equal_folded(name.data() + i, lit.data(), lit.size()))
+                    return true;
+            }
+            return false;
+        case Kind::any:
+            return true;
+        default:
+            return match_general(name);
+        }
+    }
+
+    Kind kind() const { return k; }
+    const string& literal() const { return lit; }
+
+private:
+    // есть ли символы из folding там, где имя сравнивается с литералом; у contains это всё имя
+    bool has_folding(view name) const {
+        const size_t m = lit.size();
+        if (k == Kind::prefix)
+            name = name.substr(0, m);
+        else if (k == Kind::suffix && name.size() > m)
+            name = name.substr(name.size() - m);
+        return name.find_first_of(folding) != view::npos;
+    }
+
+    bool match_simd(view name) const {
+        const size_t n = name.size(), m = lit.size();
+        switch (k) {
+        case Kind::exact:
+            return n == m && simd::equal_fold(name.data(), lit.data(), m);
+        case Kind::prefix:
+            return short_lit ? simd::prefix_fold_short(name.data(), n, head, m)
+                : (n >= m && simd::equal_fold(name.data(), lit.data(), m));
+        case Kind::suffix:
+            return short_lit ? simd::suffix_fold_short(name.data(), n, tail, m)
+                : (n >= m && simd::equal_fold(name.data() + n - m, lit.data(), m));
+        default:
+            return simd::contains_fold(name.data(), n, lit.data(), m);
+        }
+    }
+
+    // lit уже в нижнем регистре, '?' совпадает с любым символом
+    static bool equal_folded(const CharT* name, const CharT* lit, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            if (lit[i] != CharT('?') && lit[i] != fold_char(name[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // тот же алгоритм, что в matchWildcard, но регистр приводится только у имени
+    bool match_general(view name) const {
+        const size_t npos = view::npos;
+        size_t n = 0, p = 0;
+        size_t star = npos, match = 0;
+
+        while (n < name.size()) {
+            if (p < folded.size() && (folded[p] == CharT('?') || folded[p] == fold_char(name[n]))) {
+                ++n;
+                ++p;
+            }
+            else if (p < folded.size() && folded[p] == CharT('*')) {
+                star = p++;
+                match = n;
+            }
+            else if (star != npos) {
+                p = star + 1;
+                n = ++match;
+            }
+            else {
+                return false;
+            }
+        }
+
+        while (p < folded.size() && folded[p] == CharT('*'))
+            ++p;
+
+        return p == folded.size();
+    }
+
+    Kind k = Kind::any;
+    string folded;  // весь шаблон в нижнем регистре
+    string lit;     // литерал для простых форм
+    bool simd_lit = false;
+    string folding; // символы вне ASCII, которые fold_char сводит к буквам литерала: с ними — скалярный путь
+    bool short_lit = false;                          // литерал помещается в один 16-байтный регистр
+    CharT head[simd::lanes_128<CharT>] = {};         // литерал, прижатый к началу регистра (prefix*)
+    CharT tail[simd::lanes_128<CharT>] = {};         // литерал, прижатый к концу регистра (*suffix)
+};
+
+// набор шаблонов, проверяемый за один проход по имени: шаблоны вида *.ext и точные имена
+// разложены по хеш-таблицам (ключ — хеш свёрнутого расширения или имени), так что полная
+// проверка идёт только для кандидатов; остальные шаблоны проверяются по списку
+template <class CharT>
+class PatternSet {
+public:
+    using view = std::basic_string_view<CharT>;
+
+    void add(view pattern) {
+        const uint32_t idx = static_cast<uint32_t>(patterns.size());
+        patterns.emplace_back(pattern);
+        const CompiledPattern<CharT>& cp = patterns.back();
+        const auto& lit = cp.literal();
+        const bool plain = lit.find(CharT('?')) == lit.npos;
+
+        const size_t dot = lit.rfind(CharT('.'));
+        if (cp.kind() == CompiledPattern<CharT>::Kind::suffix && plain && dot != lit.npos)
+            by_ext[hash_folded(view(lit).substr(dot + 1))].push_back(idx); // у совпавшего имени то же расширение
+        else if (cp.kind() == CompiledPattern<CharT>::Kind::exact && plain)
+            by_name[hash_folded(lit)].push_back(idx);
+        else
+            others.push_back(idx);
+    }
+
+    size_t size() const { return patterns.size(); }
+
+    // номер первого (в порядке задания) совпавшего шаблона или -1
+    int match(view name) const {
+        if (patterns.size() == 1)
+            return patterns[0].match(name) ? 0 : -1;
+
+        uint32_t best = UINT32_MAX;
+        auto check = [&](const std::vector<uint32_t>& candidates) {
+            for (uint32_t idx : candidates) { // кандидаты идут по возрастанию номера
+                if (idx >= best)
+                    break;
+                if (patterns[idx].match(name)) {
+                    best = idx;
+                    break;
+                }
+            }
+        };
+
+        if (!by_ext.empty()) {
+            const size_t dot = name.rfind(CharT('.'));
+            if (dot != view::npos) {
+                auto it = by_ext.find(hash_folded(name.substr(dot + 1)));
+                if (it != by_ext.end())
+                    check(it->second);
+            }
+        }
+        if (!by_name.empty()) {
+            auto it = by_name.find(hash_folded(name));
+            if (it != by_name.end())
+                check(it->second);
+        }
+        check(others);
+        return best == UINT32_MAX ? -1 : static_cast<int>(best);
+    }
+
+private:
+    // FNV-1a по символам в нижнем регистре; коллизии безопасны — кандидат всё равно проверяется целиком
+    static uint64_t hash_folded(view s) {
+        uint64_t h = 14695981039346656037ull;
+        for (CharT c : s) {
+            h ^= static_cast<uint64_t>(fold_char(c));
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    std::vector<CompiledPattern<CharT>> patterns;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> by_ext;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> by_name;
+    std::vector<uint32_t> others;
+};
+
+using NativePatterns = PatternSet<native_char>;
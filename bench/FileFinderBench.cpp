@@ -0,0 +1,430 @@
+﻿// сквозной бенчмарк FileFinder: генерирует синтетическое дерево заданной формы,
+// запускает собранный FileFinder с разными числом потоков, бэкендами и порядком обхода,
+// на холодном и тёплом кэше, и пишет отчёты CSV/JSON для сравнения между версиями
+//
+// пример:
+//   FileFinderBench --finder=x64\Release\FileFinder.exe --root=D:\bench_tree
+//       --depth=4 --fanout=8 --files=20 --threads=1,4,16,auto --backends=stl,nt --cold
+//       --csv=bench.csv --json=bench.json
+
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+namespace fs = std::filesystem;
+
+// форма синтетического дерева
+struct TreeShape {
+    int depth = 4;           // уровней каталогов ниже корня
+    int fanout = 8;          // подкаталогов в каждом каталоге
+    int files = 20;          // файлов в каждом каталоге
+    int name_min = 4;        // длина имени без расширения
+    int name_max = 24;
+    bool name_normal = false; // false — равномерно в [min, max], true — нормально вокруг середины
+    int file_size = 0;       // байт в каждом файле
+    unsigned seed = 1;
+
+    std::string key() const { // по ключу решается, можно ли переиспользовать уже созданное дерево
+        std::ostringstream oss;
+        oss << "depth=" << depth << " fanout=" << fanout << " files=" << files << " names=" << name_min << "-" << name_max
+            << (name_normal ? "/normal" : "/uniform") << " size=" << file_size << " seed=" << seed;
+        return oss.str();
+    }
+};
+
+struct TreeStats {
+    uint64_t dirs = 0;
+    uint64_t files = 0;
+};
+
+const char* const marker_name = ".ffbench-shape";
+
+class TreeGenerator {
+public:
+    explicit TreeGenerator(const TreeShape& shape) : shape(shape), rng(shape.seed) {}
+
+    TreeStats generate(const fs::path& root) {
+        fs::create_directories(root);
+        stats = TreeStats{};
+        content.assign(static_cast<size_t>(shape.file_size), 'x');
+        fill(root, 0);
+        return stats;
+    }
+
+private:
+    std::string random_name() {
+        int len;
+        if (shape.name_normal) {
+            std::normal_distribution<double> d((shape.name_min + shape.name_max) / 2.0, std::max(1.0, (shape.name_max - shape.name_min) / 6.0));
+            len = std::clamp(static_cast<int>(d(rng) + 0.5), shape.name_min, shape.name_max);
+        }
+        else {
+            len = std::uniform_int_distribution<int>(shape.name_min, shape.name_max)(rng);
+        }
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+        std::uniform_int_distribution<int> pick(0, static_cast<int>(sizeof(alphabet)) - 2);
+        std::string name(static_cast<size_t>(std::max(1, len)), 'a');
+        for (char& c : name)
+            c = alphabet[pick(rng)];
+        return name;
+    }
+
+    void fill(const fs::path& dir, int level) {
+        ++stats.dirs;
+        static const char* const exts[] = { ".txt", ".log", ".dat", ".cpp", ".h", ".json", ".png", "" };
+        std::uniform_int_distribution<int> ext(0, static_cast<int>(std::size(exts)) - 1);
+        for (int i = 0; i < shape.files; ++i) {
+            // номер в имени исключает совпадения среди случайных имён одного каталога
+            std::ofstream(dir / (random_name() + "_" + std::to_string(i) + exts[ext(rng)]), std::ios::binary) << content;
+            ++stats.files;
+        }
+        if (level >= shape.depth)
+            return;
+        for (int i = 0; i < shape.fanout; ++i) {
+            const fs::path sub = dir / (random_name() + "_d" + std::to_string(i));
+            fs::create_directory(sub);
+            fill(sub, level + 1);
+        }
+    }
+
+    const TreeShape& shape;
+    std::mt19937 rng;
+    TreeStats stats;
+    std::string content;
+};
+
+// дерево создаётся заново, только если форма изменилась
+TreeStats prepare_tree(const fs::path& root, const TreeShape& shape) {
+    const fs::path marker = root / marker_name;
+    {
+        std::ifstream in(marker);
+        std::string key;
+        TreeStats st;
+        if (in && std::getline(in, key) && key == shape.key() && (in >> st.dirs >> st.files)) {
+            std::cout << "Дерево уже создано: " << st.dirs << " каталогов, " << st.files << " файлов\n";
+            return st;
+        }
+    }
+    if (fs::exists(root)) {
+        if (!fs::exists(marker)) {
+            std::cerr << "Ошибка: " << root.string() << " существует и создан не бенчмарком, удалять не стану\n";
+            std::exit(1);
+        }
+        fs::remove_all(root);
+    }
+    std::cout << "Создание дерева " << shape.key() << "...\n";
+    const auto t0 = std::chrono::steady_clock::now();
+    TreeStats st = TreeGenerator(shape).generate(root);
+    st.files += 1; // сам файл-маркер тоже попадает в обход
+    std::ofstream(marker) << shape.key() << "\n" << st.dirs << " " << st.files << "\n";
+    std::cout << "Готово за " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - t0).count()
+        << " с: " << st.dirs << " каталогов, " << st.files << " файлов\n";
+    return st;
+}
+
+// сброс файлового кэша ОС перед холодным прогоном; false, если не хватает прав
+bool drop_file_cache() {
+#ifdef _WIN32
+    // очистка standby-списка через NtSetSystemInformation; нужна привилегия SeProfileSingleProcessPrivilege
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return false;
+    TOKEN_PRIVILEGES tp{};
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    const bool have = LookupPrivilegeValueW(nullptr, SE_PROF_SINGLE_PROCESS_NAME, &tp.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr) && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    if (!have)
+        return false;
+
+    using SetInfoFn = LONG(NTAPI*)(int info_class, PVOID info, ULONG length);
+    static const auto set_info = reinterpret_cast<SetInfoFn>(GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtSetSystemInformation"));
+    constexpr int system_memory_list_information = 80;
+    int command = 4; // MemoryPurgeStandbyList
+    return set_info && set_info(system_memory_list_information, &command, sizeof(command)) >= 0;
+#else
+    ::sync();
+    std::ofstream drop("/proc/sys/vm/drop_caches");
+    return drop && (drop << "3\n") && drop.flush();
+#endif
+}
+
+struct ProcessResult {
+    int exit_code = -1;
+    double wall_ms = 0;
+    uint64_t peak_rss_kb = 0;
+};
+
+// запуск FileFinder с выводом в никуда; peak RSS берётся у завершившегося процесса
+ProcessResult run_process(const fs::path& exe, const std::vector<std::string>& args) {
+    ProcessResult r;
+#ifdef _WIN32
+    std::wstring cmd = L"\"" + exe.wstring() + L"\"";
+    for (const std::string& a : args)
+        cmd += L" \"" + fs::path(a).wstring() + L"\"";
+
+    SECURITY_ATTRIBUTES sa{ sizeof(sa), nullptr, TRUE };
+    HANDLE null_out = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+    STARTUPINFOW si{};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdOutput = null_out;
+    si.hStdError = null_out;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    PROCESS_INFORMATION pi{};
+
+    const auto t0 = std::chrono::steady_clock::now();
+    if (!CreateProcessW(nullptr, cmd.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi)) {
+        CloseHandle(null_out);
+        std::cerr << "Ошибка: не удалось запустить " << exe.string() << " (" << GetLastError() << ")\n";
+        return r;
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    r.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    DWORD code = 0;
+    GetExitCodeProcess(pi.hProcess, &code);
+    r.exit_code = static_cast<int>(code);
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (GetProcessMemoryInfo(pi.hProcess, &pmc, sizeof(pmc)))
+        r.peak_rss_kb = pmc.PeakWorkingSetSize / 1024;
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    CloseHandle(null_out);
+#else
+    std::vector<std::string> all{ exe.string() };
+    all.insert(all.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (std::string& a : all)
+        argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    const auto t0 = std::chrono::steady_clock::now();
+    pid_t pid;
+    const int err = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        std::cerr << "Ошибка: не удалось запустить " << exe.string() << " (" << err << ")\n";
+        return r;
+    }
+    int status = 0;
+    struct rusage usage {};
+    wait4(pid, &status, 0, &usage);
+    r.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    r.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    r.peak_rss_kb = static_cast<uint64_t>(usage.ru_maxrss); // в Linux уже в КиБ
+#endif
+    return r;
+}
+
+// число из плоского JSON, который пишет FileFinder --bench-report
+uint64_t json_number(const std::string& json, const std::string& key) {
+    const size_t pos = json.find("\"" + key + "\"");
+    if (pos == std::string::npos)
+        return 0;
+    const size_t colon = json.find(':', pos);
+    return colon == std::string::npos ? 0 : std::strtoull(json.c_str() + colon + 1, nullptr, 10);
+}
+
+struct Variant {
+    std::string backend;
+    std::string order;
+    std::string threads;
+};
+
+struct RunRecord {
+    Variant v;
+    std::string cache; // cold или warm
+    int run = 0;
+    ProcessResult proc;
+    uint64_t dirs = 0, entries = 0, matches = 0;
+    uint64_t p50_ns = 0, p99_ns = 0;
+
+    double dirs_per_s() const { return proc.wall_ms > 0 ? dirs * 1000.0 / proc.wall_ms : 0; }
+    double entries_per_s() const { return proc.wall_ms > 0 ? entries * 1000.0 / proc.wall_ms : 0; }
+};
+
+std::vector<std::string> split_list(const std::string& s) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    for (std::string item; std::getline(ss, item, ',');) {
+        if (!item.empty())
+            out.push_back(item);
+    }
+    return out;
+}
+
+void write_csv(const fs::path& file, const TreeShape& shape, const std::vector<RunRecord>& runs) {
+    std::ofstream out(file, std::ios::trunc);
+    out << "shape,backend,order,threads,cache,run,exit_code,wall_ms,dirs,entries,matches,dirs_per_s,entries_per_s,dir_p50_us,dir_p99_us,peak_rss_kb\n";
+    for (const RunRecord& r : runs) {
+        out << '"' << shape.key() << "\"," << r.v.backend << ',' << r.v.order << ',' << r.v.threads << ',' << r.cache << ','
+            << r.run << ',' << r.proc.exit_code << ',' << r.proc.wall_ms << ',' << r.dirs << ',' << r.entries << ',' << r.matches << ','
+            << static_cast<uint64_t>(r.dirs_per_s()) << ',' << static_cast<uint64_t>(r.entries_per_s()) << ','
+            << r.p50_ns / 1000.0 << ',' << r.p99_ns / 1000.0 << ',' << r.proc.peak_rss_kb << '\n';
+    }
+}
+
+void write_json(const fs::path& file, const TreeShape& shape, const TreeStats& tree, const std::vector<RunRecord>& runs) {
+    std::ofstream out(file, std::ios::trunc);
+    out << "{\n  \"shape\": {\"depth\": " << shape.depth << ", \"fanout\": " << shape.fanout << ", \"files\": " << shape.files
+        << ", \"name_min\": " << shape.name_min << ", \"name_max\": " << shape.name_max
+        << ", \"name_dist\": \"" << (shape.name_normal ? "normal" : "uniform") << "\", \"file_size\": " << shape.file_size
+        << ", \"seed\": " << shape.seed << ", \"dirs\": " << tree.dirs << ", \"files_total\": " << tree.files << "},\n  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const RunRecord& r = runs[i];
+        out << (i ? "," : "") << "\n    {\"backend\": \"" << r.v.backend << "\", \"order\": \"" << r.v.order << "\", \"threads\": \"" << r.v.threads
+            << "\", \"cache\": \"" << r.cache << "\", \"run\": " << r.run << ", \"exit_code\": " << r.proc.exit_code
+            << ", \"wall_ms\": " << r.proc.wall_ms << ", \"dirs\": " << r.dirs << ", \"entries\": " << r.entries << ", \"matches\": " << r.matches
+            << ", \"dirs_per_s\": " << static_cast<uint64_t>(r.dirs_per_s()) << ", \"entries_per_s\": " << static_cast<uint64_t>(r.entries_per_s())
+            << ", \"dir_p50_us\": " << r.p50_ns / 1000.0 << ", \"dir_p99_us\": " << r.p99_ns / 1000.0 << ", \"peak_rss_kb\": " << r.proc.peak_rss_kb << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "ru");
+
+    TreeShape shape;
+    fs::path finder, root;
+    std::string pattern = "*.log";
+    std::vector<std::string> threads{ "1", "4", "auto" };
+    std::vector<std::string> backends{ "stl" };
+    std::vector<std::string> orders{ "dfs" };
+    int repeat = 3;
+    bool cold = false;
+    std::string csv_file = "bench.csv", json_file = "bench.json";
+
+    bool bad = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+        auto number = [&] { return std::atoi(value.c_str()); };
+        if (key == "--finder") finder = value;
+        else if (key == "--root") root = value;
+        else if (key == "--depth") shape.depth = std::max(0, number());
+        else if (key == "--fanout") shape.fanout = std::max(0, number());
+        else if (key == "--files") shape.files = std::max(0, number());
+        else if (key == "--name-len") {
+            if (std::sscanf(value.c_str(), "%d-%d", &shape.name_min, &shape.name_max) != 2 || shape.name_min < 1 || shape.name_max < shape.name_min)
+                bad = true;
+        }
+        else if (key == "--name-dist") shape.name_normal = value == "normal";
+        else if (key == "--file-size") shape.file_size = std::max(0, number());
+        else if (key == "--seed") shape.seed = static_cast<unsigned>(number());
+        else if (key == "--pattern") pattern = value;
+        else if (key == "--threads") threads = split_list(value);
+        else if (key == "--backends") backends = split_list(value);
+        else if (key == "--orders") orders = split_list(value);
+        else if (key == "--repeat") repeat = std::max(1, number());
+        else if (key == "--cold") cold = true;
+        else if (key == "--csv") csv_file = value;
+        else if (key == "--json") json_file = value;
+        else {
+            std::cerr << "Неизвестный параметр: " << arg << "\n";
+            bad = true;
+        }
+    }
+    if (bad || finder.empty() || root.empty()) {
+        std::cout << "Использование:\n"
+            << "  " << argv[0] << " --finder=<FileFinder.exe> --root=<каталог для дерева> [параметры]\n\n"
+            << "Форма дерева:\n"
+            << "  --depth=N               уровней каталогов (по умолчанию 4)\n"
+            << "  --fanout=N              подкаталогов в каталоге (8)\n"
+            << "  --files=N               файлов в каталоге (20)\n"
+            << "  --name-len=MIN-MAX      длина имён (4-24)\n"
+            << "  --name-dist=uniform|normal\n"
+            << "  --file-size=N           байт в файле (0)\n"
+            << "  --seed=N                зерно генератора (1)\n\n"
+            << "Прогоны:\n"
+            << "  --pattern=<шаблон>      шаблон поиска (*.log)\n"
+            << "  --threads=1,4,auto      числа потоков\n"
+            << "  --backends=stl,win32,nt,iocp\n"
+            << "  --orders=dfs,bfs,hybrid\n"
+            << "  --repeat=N              тёплых прогонов на вариант (3)\n"
+            << "  --cold                  перед первым прогоном варианта сбрасывать файловый кэш (нужны права администратора)\n"
+            << "  --csv=<файл>, --json=<файл>  отчёты (bench.csv, bench.json)\n";
+        return 1;
+    }
+
+    const TreeStats tree = prepare_tree(root, shape);
+    const fs::path report_file = fs::temp_directory_path() / "ffbench-report.json";
+
+    bool cold_ok = cold;
+    std::vector<RunRecord> runs;
+    for (const std::string& backend : backends) {
+        for (const std::string& order : orders) {
+            for (const std::string& t : threads) {
+                const Variant v{ backend, order, t };
+                const int total = repeat + (cold ? 1 : 0);
+                for (int run = 0; run < total; ++run) {
+                    RunRecord rec;
+                    rec.v = v;
+                    rec.run = run;
+                    rec.cache = "warm";
+                    if (cold && run == 0) {
+                        if (cold_ok && !drop_file_cache()) {
+                            std::cerr << "Предупреждение: сбросить файловый кэш не удалось, холодные прогоны пропускаются\n";
+                            cold_ok = false;
+                        }
+                        if (!cold_ok)
+                            continue;
+                        rec.cache = "cold";
+                    }
+
+                    std::error_code ec;
+                    fs::remove(report_file, ec);
+                    rec.proc = run_process(finder, { root.string(), pattern, t, "--backend=" + backend, "--order=" + order,
+                        "--log-level=off", "--bench-report=" + report_file.string() });
+                    std::ifstream in(report_file);
+                    const std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+                    rec.dirs = json_number(json, "dirs");
+                    rec.entries = json_number(json, "entries");
+                    rec.matches = json_number(json, "matches");
+                    rec.p50_ns = json_number(json, "dir_p50_ns");
+                    rec.p99_ns = json_number(json, "dir_p99_ns");
+
+                    std::printf("%-6s %-6s %-5s %-4s #%d  %9.1f ms  %10.0f dirs/s  %11.0f entries/s  p50 %8.1f us  p99 %8.1f us  rss %7llu KiB%s\n",
+                        backend.c_str(), order.c_str(), t.c_str(), rec.cache.c_str(), run, rec.proc.wall_ms, rec.dirs_per_s(), rec.entries_per_s(),
+                        rec.p50_ns / 1000.0, rec.p99_ns / 1000.0, static_cast<unsigned long long>(rec.proc.peak_rss_kb),
+                        rec.proc.exit_code == 0 ? "" : "  (ошибка)");
+                    runs.push_back(rec);
+                }
+            }
+        }
+    }
+
+    write_csv(csv_file, shape, runs);
+    write_json(json_file, shape, tree, runs);
+    std::cout << "Отчёты: " << csv_file << ", " << json_file << "\n";
+    return 0;
+}
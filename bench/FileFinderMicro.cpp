@@ -0,0 +1,259 @@
+﻿// микробенчмарки горячих компонентов FileFinder отдельно от файловой системы:
+// сопоставление с шаблоном (matchWildcard, CompiledPattern, PatternSet) и очередь каталогов
+// под конкуренцией от 1 до 128 потоков
+//
+// пример:
+//   FileFinderMicro                     все наборы
+//   FileFinderMicro --suite=queue --min-time=500 --csv=micro.csv
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../Wildcard.h"
+#include "../DirQueue.h"
+
+using native_pattern = CompiledPattern<native_char>;
+
+// узкая ASCII-строка в родном для путей типе символов
+native_string widen(const std::string& s) {
+    return native_string(s.begin(), s.end());
+}
+
+struct Result {
+    std::string suite;
+    std::string name;
+    double ns_per_op;
+    double mops;
+};
+
+std::vector<Result> results;
+double min_time_ms = 200;
+
+void report(const std::string& suite, const std::string& name, double ns_per_op) {
+    const double mops = ns_per_op > 0 ? 1000.0 / ns_per_op : 0;
+    std::printf("%-9s %-48s %10.2f нс/оп %10.2f Mоп/с\n", suite.c_str(), name.c_str(), ns_per_op, mops);
+    results.push_back({ suite, name, ns_per_op, mops });
+}
+
+// прогон f(iters) с удвоением числа итераций, пока замер не займёт min_time_ms
+template <class F>
+double time_per_op(F&& f) {
+    using clock = std::chrono::steady_clock;
+    for (size_t iters = 64;; iters *= 2) {
+        const auto t0 = clock::now();
+        f(iters);
+        const double ns = std::chrono::duration<double, std::nano>(clock::now() - t0).count();
+        if (ns >= min_time_ms * 1e6 || iters >= (size_t(1) << 40))
+            return ns / static_cast<double>(iters);
+    }
+}
+
+// результат сопоставления уходит сюда, чтобы компилятор не выбросил вызов
+std::atomic<size_t> sink{ 0 };
+
+// имя заданной длины: случайные буквы и цифры, при необходимости с расширением в конце
+std::string make_name(size_t len, const std::string& ext, unsigned seed) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::string s;
+    unsigned x = seed * 2654435761u + 1;
+    while (s.size() + ext.size() < len) {
+        x = x * 1103515245u + 12345u;
+        s.push_back(alphabet[(x >> 16) % (sizeof(alphabet) - 1)]);
+    }
+    return s + ext;
+}
+
+void bench_wildcard() {
+    struct Shape {
+        const char* pattern;
+        const char* ext; // расширение в именах набора, чтобы часть шаблонов совпадала
+    };
+    const Shape shapes[] = {
+        { "*.log", ".log" },
+        { "*.log", ".txt" },
+        { "report*", ".txt" },
+        { "*mid*", ".dat" },
+        { "exact_name.txt", ".txt" },
+        { "a?c*.t?t", ".txt" },
+        { "*", ".cpp" },
+    };
+    const size_t lengths[] = { 8, 32, 128, 255 };
+    constexpr size_t names_per_set = 256;
+
+    for (const Shape& shape : shapes) {
+        const native_string pattern = widen(shape.pattern);
+        const native_pattern compiled{ native_view(pattern) };
+        for (size_t len : lengths) {
+            std::vector<native_string> names;
+            for (size_t i = 0; i < names_per_set; ++i)
+                names.push_back(widen(make_name(len, shape.ext, static_cast<unsigned>(i))));
+
+            const std::string label = std::string(shape.pattern) + " / " + std::to_string(len) + " симв. " + shape.ext;
+            report("wildcard", "matchWildcard   " + label, time_per_op([&](size_t iters) {
+                size_t hits = 0;
+                for (size_t i = 0; i < iters; ++i)
+                    hits += matchWildcard(native_view(names[i % names_per_set]), native_view(pattern));
+                sink += hits;
+            }));
+            report("wildcard", "CompiledPattern " + label, time_per_op([&](size_t iters) {
+                size_t hits = 0;
+                for (size_t i = 0; i < iters; ++i)
+                    hits += compiled.match(native_view(names[i % names_per_set]));
+                sink += hits;
+            }));
+        }
+    }
+
+    // перебор с возвратами: имя из одних 'a' не совпадает ни с одним шаблоном, и каждая '*'
+    // заново пробует все позиции
+    const char* const pathological[] = { "*a*b", "*a*a*b", "*a*a*a*b", "*a*a*a*a*a*a*b", "a*a*a*a*a*a*a*a*c" };
+    for (const char* p : pathological) {
+        const native_string pattern = widen(p);
+        const native_pattern compiled{ native_view(pattern) };
+        for (size_t len : { size_t(32), size_t(255) }) {
+            const native_string name(len, native_char('a'));
+            const std::string label = std::string(p) + " / " + std::to_string(len) + " x 'a'";
+            report("backtrack", "matchWildcard   " + label, time_per_op([&](size_t iters) {
+                size_t hits = 0;
+                for (size_t i = 0; i < iters; ++i)
+                    hits += matchWildcard(native_view(name), native_view(pattern));
+                sink += hits;
+            }));
+            report("backtrack", "CompiledPattern " + label, time_per_op([&](size_t iters) {
+                size_t hits = 0;
+                for (size_t i = 0; i < iters; ++i)
+                    hits += compiled.match(native_view(name));
+                sink += hits;
+            }));
+        }
+    }
+
+    // набор из многих расширений: проверка идёт через хеш-таблицу, а не по списку
+    PatternSet<native_char> set;
+    for (const char* ext : { "log", "txt", "cpp", "h", "json", "xml", "dat", "bin", "png", "jpg", "md", "ini" })
+        set.add(widen(std::string("*.") + ext));
+    std::vector<native_string> names;
+    const char* const exts[] = { ".log", ".obj", ".cpp", ".pdb", ".json", ".tmp" };
+    for (size_t i = 0; i < names_per_set; ++i)
+        names.push_back(widen(make_name(24, exts[i % std::size(exts)], static_cast<unsigned>(i))));
+    report("wildcard", "PatternSet 12 x *.ext / 24 симв.", time_per_op([&](size_t iters) {
+        size_t hits = 0;
+        for (size_t i = 0; i < iters; ++i)
+            hits += set.match(native_view(names[i % names_per_set])) >= 0;
+        sink += hits;
+    }));
+}
+
+// обход синтетического дерева через очередь, как в main: каждый взятый узел уровня v > 0
+// кладёт fanout детей уровня v - 1 в свой дек; pending считает ещё не обработанные узлы.
+// Узел кодируется как уровень, работы на узел нет — меряется только очередь
+double queue_tree(int threads, Traversal policy, int depth, int fanout, size_t& nodes) {
+    BasicDirQueue<int> q(threads, policy);
+    std::atomic<int> pending{ 1 };
+    std::atomic<bool> stop{ false };
+    std::atomic<size_t> total{ 0 };
+    q.push(0, depth);
+
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int id = 0; id < threads; ++id) {
+        pool.emplace_back([&, id] {
+            size_t done = 0;
+            int level;
+            while (q.pop_or_wait(id, level, pending, stop)) {
+                if (level > 0) {
+                    pending.fetch_add(fanout);
+                    for (int i = 0; i < fanout; ++i)
+                        q.push(id, level - 1);
+                }
+                ++done;
+                if (pending.fetch_sub(1) == 1)
+                    q.notify_all();
+            }
+            total += done;
+        });
+    }
+    for (std::thread& t : pool)
+        t.join();
+    nodes = total;
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// каждый поток кладёт и сразу забирает свои элементы: стоимость push/pop без перехвата,
+// но с общими счётчиками queued и sleeping
+double queue_local(int threads, size_t per_thread) {
+    BasicDirQueue<int> q(threads, Traversal::dfs);
+    std::atomic<int> pending{ 1 }; // не даёт pop_or_wait вернуть false на пустом деке
+    std::atomic<bool> stop{ false };
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int id = 0; id < threads; ++id) {
+        pool.emplace_back([&, id] {
+            int v;
+            for (size_t i = 0; i < per_thread; ++i) {
+                q.push(id, 1);
+                q.pop_or_wait(id, v, pending, stop);
+            }
+        });
+    }
+    for (std::thread& t : pool)
+        t.join();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void bench_queue() {
+    const int thread_counts[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    for (int threads : thread_counts) {
+        const size_t per_thread = 200000;
+        const double ns = queue_local(threads, per_thread);
+        report("queue", "push+pop свой дек, потоков " + std::to_string(threads), ns / (per_thread * threads));
+    }
+    // дерево 8^7 ≈ 2,4 млн узлов; всё, кроме корня, достаётся остальным потокам перехватом
+    for (Traversal policy : { Traversal::dfs, Traversal::bfs, Traversal::hybrid }) {
+        for (int threads : thread_counts) {
+            size_t nodes = 0;
+            const double ns = queue_tree(threads, policy, 7, 8, nodes);
+            report("queue", std::string("дерево 8^7, ") + traversal_name(policy) + ", потоков " + std::to_string(threads),
+                nodes ? ns / nodes : 0);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "ru");
+
+    std::string suite = "all", csv_file;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--suite=", 0) == 0)
+            suite = arg.substr(8);
+        else if (arg.rfind("--min-time=", 0) == 0)
+            min_time_ms = std::max(1.0, std::atof(arg.c_str() + 11));
+        else if (arg.rfind("--csv=", 0) == 0)
+            csv_file = arg.substr(6);
+        else {
+            std::cout << "Использование: " << argv[0] << " [--suite=all|wildcard|queue] [--min-time=мс] [--csv=<файл>]\n";
+            return 1;
+        }
+    }
+
+    if (suite == "all" || suite == "wildcard")
+        bench_wildcard();
+    if (suite == "all" || suite == "queue")
+        bench_queue();
+
+    if (!csv_file.empty()) {
+        std::ofstream out(csv_file, std::ios::trunc);
+        out << "suite,name,ns_per_op,mops\n";
+        for (const Result& r : results)
+            out << r.suite << ",\"" << r.name << "\"," << r.ns_per_op << ',' << r.mops << '\n';
+    }
+    return sink.load() == size_t(-1); // не бывает; чтение не даёт выбросить замеры
+}